@@ -8,9 +8,13 @@
  * © 2019 by Richard Walters
  */
 
+#include <functional>
 #include <memory>
 #include <Sasl/Client/Mechanism.hpp>
 #include <Smtp/Client.hpp>
+#include <SmtpAuth/ReplyClassification.hpp>
+#include <SmtpAuth/RetryPolicy.hpp>
+#include <SmtpAuth/TimerWheel.hpp>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
 
 namespace SmtpAuth {
@@ -31,6 +35,83 @@ namespace SmtpAuth {
         Client& operator=(const Client&) = delete;
         Client& operator=(Client&&) noexcept;
 
+        // Types
+    public:
+        /**
+         * This is the type of function which can be registered in place
+         * of a mechanism instance, in order to construct instances of the
+         * mechanism only when the mechanism is actually selected for use.
+         */
+        typedef std::function<
+            std::shared_ptr< Sasl::Client::Mechanism >()
+        > MechanismFactory;
+
+        /**
+         * These are the reasons why an authentication exchange
+         * may have failed.
+         */
+        enum class FailureReason {
+            /**
+             * The exchange has not failed.
+             */
+            None,
+
+            /**
+             * The server rejected the authentication.
+             */
+            Rejected,
+
+            /**
+             * The whole exchange took longer than allowed.
+             */
+            ExchangeTimeout,
+
+            /**
+             * The server took longer than allowed to reply
+             * to one step of the exchange.
+             */
+            StepTimeout,
+
+            /**
+             * The retry policy's circuit breaker for the server
+             * refused to allow an attempt.
+             */
+            CircuitOpen,
+        };
+
+        /**
+         * This holds what is known in advance about how the server
+         * will challenge the client for one SASL mechanism, which is
+         * used to save round trips when the SetMinimizeRoundTrips
+         * method has been used to enable it.
+         */
+        struct ChallengePrediction {
+            /**
+             * This indicates whether or not the mechanism allows the
+             * client to send an initial response with the AUTH command.
+             * If so, and the mechanism has no initial response of its
+             * own, the response to the first challenge (an empty one,
+             * unless the first challenge is known) is sent with the AUTH
+             * command, as "=" if it's empty, rather than waiting for the
+             * server to send the challenge.
+             */
+            bool initialResponseAllowed = false;
+
+            /**
+             * This indicates whether or not the first challenge the
+             * server will send for the mechanism is known in advance.
+             * If so, and an initial response is allowed, the response
+             * to the first challenge is sent as the initial response.
+             */
+            bool firstChallengeKnown = false;
+
+            /**
+             * This is the first challenge the server will send for the
+             * mechanism, if it's known in advance.
+             */
+            std::string firstChallenge;
+        };
+
         // Public methods
     public:
         /**
@@ -80,6 +161,41 @@ namespace SmtpAuth {
             std::shared_ptr< Sasl::Client::Mechanism > mechImpl
         );
 
+        /**
+         * This adds an authentication mechanism to be used if supported,
+         * where instances of the mechanism are obtained from a factory
+         * only if the mechanism is selected.
+         *
+         * Instances are kept in per-thread pools, one for each factory,
+         * shared by all clients which register the same factory object.
+         * An instance is taken from the pool (or made by the factory if
+         * the pool is empty) when the mechanism is selected, and is
+         * reset, with its credentials cleared, and returned to the pool
+         * when the client is reset.  An instance still in use when the
+         * client is destroyed is dropped rather than returned to the pool.
+         * While a thread's pool holds unused instances made by a factory,
+         * it also holds a reference to the factory, keeping it alive until
+         * the instances are taken again or the thread exits.
+         *
+         * @param[in] mechName
+         *     This is the name that the SMTP server recognizes for the
+         *     chosen authentication mechanism.
+         *
+         * @param[in] rank
+         *     This is used to select from multiple supported mechanisms,
+         *     where the one with the highest rank is selected.
+         *
+         * @param[in] mechFactory
+         *     This is the function to call to construct a new instance
+         *     of the authentication mechanism, if none is available
+         *     in the pool.  It also identifies the pool to use.
+         */
+        void RegisterFactory(
+            const std::string& mechName,
+            int rank,
+            std::shared_ptr< MechanismFactory > mechFactory
+        );
+
         /**
          * Set the identities and credentials to use in the authentication.
          *
@@ -103,6 +219,145 @@ namespace SmtpAuth {
             const std::string& authorizationIdentity = ""
         );
 
+        /**
+         * Set deadlines for authentication exchanges.  If a deadline
+         * passes, the exchange is cancelled (by sending the "*" line
+         * defined in RFC 4954), and the stage is completed
+         * unsuccessfully, with the reason available from the
+         * GetFailureReason method.
+         *
+         * The delegates given to the GoAhead method are called from
+         * whichever thread advances the timer wheel when a deadline
+         * passes.  If the wheel is driven by its own worker thread
+         * (see TimerWheel::Start), this is not the thread used by the
+         * SMTP client, so the delegates must be safe to call from it.
+         *
+         * @param[in] timerWheel
+         *     This is the timer wheel used to schedule the deadlines.
+         *     It's expected to be shared by many clients.
+         *
+         * @param[in] exchangeTimeout
+         *     This is the maximum amount of time, in seconds, allowed
+         *     for the whole exchange, from sending the AUTH command
+         *     until the final reply from the server.  Zero means there
+         *     is no limit.
+         *
+         * @param[in] stepTimeout
+         *     This is the maximum amount of time, in seconds, allowed
+         *     for the server to reply to each message sent to it during
+         *     the exchange.  Zero means there is no limit.
+         */
+        void SetTimeouts(
+            std::shared_ptr< TimerWheel > timerWheel,
+            double exchangeTimeout,
+            double stepTimeout
+        );
+
+        /**
+         * Return the reason why the most recent authentication exchange
+         * failed, if it did.
+         *
+         * @return
+         *     The reason why the most recent authentication exchange
+         *     failed is returned, or FailureReason::None if it hasn't
+         *     failed.
+         */
+        FailureReason GetFailureReason() const;
+
+        /**
+         * Set the policy used to decide whether and when to retry
+         * failed authentication exchanges.
+         *
+         * Retryable transient rejections (see
+         * ReplyClassification::retryable) which the policy decides to
+         * retry are retried within the same session, by sending the AUTH
+         * command again after the delay chosen by the policy, without
+         * completing the stage.  This requires the timer wheel given to
+         * the SetTimeouts method, so the AUTH command is sent again from
+         * the thread which advances the wheel.  The outcomes of all
+         * exchanges are reported to the policy, so the caller should not
+         * report them again.  If the server replies 421 because it's
+         * closing the connection, the failure is reported as transient,
+         * but not retried within the session; the caller may instead
+         * use the GetRetryDecision method to decide whether and when to
+         * try again with a new connection.
+         * Before each attempt, the policy's circuit breaker for the
+         * server is checked, and if it refuses, the stage is completed
+         * unsuccessfully without sending anything, with the reason
+         * given as FailureReason::CircuitOpen.
+         *
+         * @param[in] retryPolicy
+         *     This is the policy used to decide whether and when to
+         *     retry failed authentication exchanges.  It's expected to
+         *     be shared by many clients.
+         *
+         * @param[in] server
+         *     This identifies the server to which the client is
+         *     connected, for the sake of the policy's circuit breakers.
+         */
+        void SetRetryPolicy(
+            std::shared_ptr< RetryPolicy > retryPolicy,
+            const std::string& server
+        );
+
+        /**
+         * Return the classification of the most recent reply received
+         * from the server during the current or most recent
+         * authentication exchange.
+         *
+         * @return
+         *     The classification of the most recent reply received
+         *     from the server is returned.
+         */
+        ReplyClassification GetLastReplyClassification() const;
+
+        /**
+         * Return the decision made by the retry policy for the most
+         * recent failed authentication exchange, if it wasn't retried
+         * within the session.  The caller may use this to decide
+         * whether and when to try again with a new session.
+         *
+         * @return
+         *     The decision made by the retry policy for the most recent
+         *     failed authentication exchange is returned.  If there is
+         *     no retry policy, or the exchange didn't fail, the decision
+         *     is not to retry.
+         */
+        RetryPolicy::Decision GetRetryDecision() const;
+
+        /**
+         * Enable or disable the mode in which the client tries to save
+         * round trips to the server, by sending initial responses with
+         * the AUTH command wherever the mechanism allows it, including
+         * responses to the first challenge where it's known in advance.
+         *
+         * This relies on the challenge prediction for the selected
+         * mechanism.  Predictions are built in for common mechanisms,
+         * and may be added or replaced using the SetChallengePrediction
+         * method.  The mode is disabled by default.
+         *
+         * @param[in] minimizeRoundTrips
+         *     This indicates whether or not to try to save round trips.
+         */
+        void SetMinimizeRoundTrips(bool minimizeRoundTrips);
+
+        /**
+         * Set what is known in advance about how the server will
+         * challenge the client for the given SASL mechanism.
+         *
+         * @param[in] mechName
+         *     This is the name that the SMTP server recognizes for the
+         *     authentication mechanism.
+         *
+         * @param[in] prediction
+         *     This holds what is known in advance about how the server
+         *     will challenge the client for the mechanism.
+         */
+        void SetChallengePrediction(
+            const std::string& mechName,
+            const ChallengePrediction& prediction
+        );
+
         // Smtp::Client::Extension
     public:
         virtual void Configure(const std::string& parameters) override;
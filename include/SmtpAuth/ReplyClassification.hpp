@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * @file ReplyClassification.hpp
+ *
+ * This module declares the SmtpAuth::ReplyClassification structure
+ * and the SmtpAuth::ClassifyReply function.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <Smtp/Client.hpp>
+
+namespace SmtpAuth {
+
+    /**
+     * This holds the classification of a reply from an SMTP server,
+     * based on its reply code and its enhanced status code
+     * [RFC 3463](https://tools.ietf.org/html/rfc3463), if any.
+     */
+    struct ReplyClassification {
+        // Types
+
+        /**
+         * These are the kinds of outcomes a reply may indicate.
+         */
+        enum class Severity {
+            /**
+             * The command was completed successfully.
+             */
+            Success,
+
+            /**
+             * The server needs more information to complete the command.
+             */
+            Intermediate,
+
+            /**
+             * The command failed, but the failure is temporary, so it
+             * may succeed if tried again later.
+             */
+            Transient,
+
+            /**
+             * The command failed, and will keep failing if tried again
+             * without changing something.
+             */
+            Permanent,
+        };
+
+        // Properties
+
+        /**
+         * This indicates the kind of outcome the reply indicates.
+         */
+        Severity severity = Severity::Permanent;
+
+        /**
+         * This indicates whether or not sending the same command again
+         * later, unchanged, on the same connection may succeed.  This is
+         * only set for transient failures, and not for those which call
+         * for the client to do something different, such as reconnect
+         * because the server is closing the connection (reply code 421),
+         * or make a password transition (reply code 432, or enhanced
+         * status code 4.7.12), or those where the enhanced status code
+         * marks the failure as permanent.
+         */
+        bool retryable = false;
+
+        /**
+         * This is the reply code of the reply.
+         */
+        int code = 0;
+
+        /**
+         * This flag indicates whether or not the reply included an
+         * enhanced status code.
+         */
+        bool hasEnhancedStatusCode = false;
+
+        /**
+         * This is the class (first part) of the enhanced status code,
+         * if the reply had one.
+         */
+        int enhancedStatusClass = 0;
+
+        /**
+         * This is the subject (second part) of the enhanced status code,
+         * if the reply had one.
+         */
+        int enhancedStatusSubject = 0;
+
+        /**
+         * This is the detail (third part) of the enhanced status code,
+         * if the reply had one.
+         */
+        int enhancedStatusDetail = 0;
+    };
+
+    /**
+     * Classify the given reply from an SMTP server.
+     *
+     * The reply code decides the severity, as required by
+     * [RFC 5321](https://tools.ietf.org/html/rfc5321).  The enhanced
+     * status code decides the severity only if the reply code is not
+     * one of the recognized kinds, but it's also used to decide whether
+     * or not a transient failure is retryable.
+     *
+     * @param[in] message
+     *     This is the reply to classify.
+     *
+     * @return
+     *     The classification of the reply is returned.
+     */
+    ReplyClassification ClassifyReply(const Smtp::Client::ParsedMessage& message);
+
+}
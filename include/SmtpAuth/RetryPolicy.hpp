@@ -0,0 +1,190 @@
+#pragma once
+
+/**
+ * @file RetryPolicy.hpp
+ *
+ * This module declares the SmtpAuth::RetryPolicy class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <SmtpAuth/TimeKeeper.hpp>
+#include <stddef.h>
+#include <string>
+
+namespace SmtpAuth {
+
+    /**
+     * This class decides whether and when to retry failed authentication
+     * attempts.  Retries are delayed using exponential backoff with
+     * random jitter, and each server has a circuit breaker which stops
+     * attempts to a server after repeated transient failures, until
+     * a cool-down period has passed.
+     *
+     * The policy is expected to be shared by many clients, and is
+     * safe to use from multiple threads.
+     */
+    class RetryPolicy {
+        // Types
+    public:
+        /**
+         * This holds the settings which control the policy.
+         */
+        struct Configuration {
+            /**
+             * This is the maximum number of times to retry
+             * a failed attempt.
+             */
+            size_t maxRetries = 3;
+
+            /**
+             * This is the upper bound, in seconds, of the delay before
+             * the first retry.  The bound doubles for each subsequent
+             * retry.
+             */
+            double baseDelay = 0.5;
+
+            /**
+             * This is the largest upper bound, in seconds, of the delay
+             * before any retry.
+             */
+            double maxDelay = 30.0;
+
+            /**
+             * This is the number of consecutive transient failures
+             * for a server which opens its circuit breaker.
+             */
+            size_t failureThreshold = 5;
+
+            /**
+             * This is the amount of time, in seconds, that a server's
+             * circuit breaker stays open before another attempt to
+             * the server is allowed.
+             */
+            double openDuration = 60.0;
+        };
+
+        /**
+         * This holds the decision made by the policy after a failure.
+         */
+        struct Decision {
+            /**
+             * This indicates whether or not the attempt should
+             * be retried.
+             */
+            bool retry = false;
+
+            /**
+             * This is the amount of time, in seconds, to wait
+             * before retrying the attempt.
+             */
+            double delay = 0.0;
+        };
+
+        // Lifecycle management
+    public:
+        ~RetryPolicy() noexcept;
+        RetryPolicy(const RetryPolicy&) = delete;
+        RetryPolicy(RetryPolicy&&) noexcept;
+        RetryPolicy& operator=(const RetryPolicy&) = delete;
+        RetryPolicy& operator=(RetryPolicy&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor, which uses the default
+         * settings and the system's monotonic clock.
+         */
+        RetryPolicy();
+
+        /**
+         * This is the constructor.
+         *
+         * @param[in] configuration
+         *     This holds the settings which control the policy.
+         *
+         * @param[in] timeKeeper
+         *     This is the object used to track time.  If null, the
+         *     policy uses the system's monotonic clock.
+         */
+        explicit RetryPolicy(
+            const Configuration& configuration,
+            std::shared_ptr< TimeKeeper > timeKeeper = nullptr
+        );
+
+        /**
+         * This method checks whether or not the circuit breaker for the
+         * given server allows an attempt to be made.  If the breaker
+         * has been open for its cool-down period, one trial attempt is
+         * allowed, and further attempts are refused until the outcome
+         * of the trial is reported.
+         *
+         * @param[in] server
+         *     This identifies the server to which the attempt would
+         *     be made.
+         *
+         * @return
+         *     An indication of whether or not an attempt to the server
+         *     is allowed is returned.
+         */
+        bool IsAttemptAllowed(const std::string& server);
+
+        /**
+         * This method reports that an attempt to the given server
+         * succeeded, closing its circuit breaker.
+         *
+         * @param[in] server
+         *     This identifies the server to which the attempt was made.
+         */
+        void ReportSuccess(const std::string& server);
+
+        /**
+         * This method reports that an attempt to the given server
+         * failed, and decides whether and when to retry it.
+         *
+         * Transient failures count towards opening the server's circuit
+         * breaker, and are retried unless the breaker is open or the
+         * retries are used up.  Permanent failures show the server is
+         * responsive, so they close the breaker, but they are never
+         * retried.  A transient failure reported once an open breaker's
+         * cool-down period has passed counts as a failed trial attempt,
+         * so the breaker stays open for another cool-down period.
+         *
+         * @param[in] server
+         *     This identifies the server to which the attempt was made.
+         *
+         * @param[in] transient
+         *     This indicates whether or not the failure was transient,
+         *     such that retrying the attempt unchanged may succeed.
+         *
+         * @param[in] retriesSoFar
+         *     This is the number of times the attempt has already
+         *     been retried.
+         *
+         * @return
+         *     The decision of whether and when to retry the attempt
+         *     is returned.
+         */
+        Decision ReportFailure(
+            const std::string& server,
+            bool transient,
+            size_t retriesSoFar
+        );
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
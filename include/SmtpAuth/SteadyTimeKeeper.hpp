@@ -0,0 +1,28 @@
+#pragma once
+
+/**
+ * @file SteadyTimeKeeper.hpp
+ *
+ * This module declares the SmtpAuth::SteadyTimeKeeper class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <SmtpAuth/TimeKeeper.hpp>
+
+namespace SmtpAuth {
+
+    /**
+     * This is an implementation of the SmtpAuth::TimeKeeper interface
+     * which uses the system's monotonic clock.  It's used by the timing
+     * components of this library when no other time keeper is given.
+     */
+    class SteadyTimeKeeper
+        : public TimeKeeper
+    {
+        // SmtpAuth::TimeKeeper
+    public:
+        virtual double GetCurrentTime() override;
+    };
+
+}
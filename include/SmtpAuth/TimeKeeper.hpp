@@ -0,0 +1,33 @@
+#pragma once
+
+/**
+ * @file TimeKeeper.hpp
+ *
+ * This module declares the SmtpAuth::TimeKeeper interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+namespace SmtpAuth {
+
+    /**
+     * This represents the time-keeping requirements of the timing
+     * components of this library.  To integrate them into a larger
+     * program, or to test them with a fake clock, implement this
+     * interface in terms of the actual time-keeping available.
+     */
+    class TimeKeeper {
+    public:
+        // Methods
+
+        /**
+         * This method returns the current time, in seconds, relative
+         * to an arbitrary but fixed reference point.
+         *
+         * @return
+         *     The current time is returned, in seconds.
+         */
+        virtual double GetCurrentTime() = 0;
+    };
+
+}
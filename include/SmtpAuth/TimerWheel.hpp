@@ -0,0 +1,148 @@
+#pragma once
+
+/**
+ * @file TimerWheel.hpp
+ *
+ * This module declares the SmtpAuth::TimerWheel class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <functional>
+#include <memory>
+#include <SmtpAuth/TimeKeeper.hpp>
+#include <stddef.h>
+
+namespace SmtpAuth {
+
+    /**
+     * This class implements a hashed timer wheel, which can be shared
+     * by many clients in order to schedule deadlines without needing
+     * a separate timer per client.
+     *
+     * The wheel may be driven either by calling the Advance method
+     * directly (for example, from an existing event loop, or from a
+     * test using a fake time keeper), or by calling the Start method
+     * to have a worker thread advance the wheel once per tick.
+     * Callbacks are called on whichever thread advances the wheel,
+     * so when the worker thread is used, they're called on it.
+     */
+    class TimerWheel {
+        // Types
+    public:
+        /**
+         * This is the type of value used to identify a scheduled
+         * callback, in order to cancel it.  Zero is never used to
+         * identify a scheduled callback.
+         */
+        typedef int Token;
+
+        // Lifecycle management
+    public:
+        ~TimerWheel() noexcept;
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel(TimerWheel&&) noexcept;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+        TimerWheel& operator=(TimerWheel&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the constructor.
+         *
+         * @param[in] timeKeeper
+         *     This is the object used to track time.  If null, the
+         *     wheel uses the system's monotonic clock.
+         *
+         * @param[in] tickDuration
+         *     This is the amount of time, in seconds, covered by
+         *     each slot of the wheel.  Callbacks are called at most
+         *     one tick after their deadlines.
+         *
+         * @param[in] numSlots
+         *     This is the number of slots in the wheel.
+         */
+        explicit TimerWheel(
+            std::shared_ptr< TimeKeeper > timeKeeper = nullptr,
+            double tickDuration = 0.1,
+            size_t numSlots = 512
+        );
+
+        /**
+         * This method returns the current time, according to the
+         * time keeper used by the wheel.
+         *
+         * @return
+         *     The current time is returned, in seconds.
+         */
+        double GetCurrentTime();
+
+        /**
+         * This method schedules the given callback to be called once
+         * the given amount of time has elapsed.
+         *
+         * @param[in] timeout
+         *     This is the amount of time, in seconds, to wait before
+         *     calling the callback.
+         *
+         * @param[in] callback
+         *     This is the function to call once the time has elapsed.
+         *     It is called without any locks of the wheel held, so it
+         *     may schedule or cancel callbacks.
+         *
+         * @return
+         *     A token which may be used to cancel the scheduled callback
+         *     is returned.
+         */
+        Token Schedule(
+            double timeout,
+            std::function< void() > callback
+        );
+
+        /**
+         * This method cancels the scheduled callback identified by
+         * the given token, if it hasn't yet been called.
+         *
+         * @param[in] token
+         *     This identifies the scheduled callback to cancel.
+         */
+        void Cancel(Token token);
+
+        /**
+         * This method checks the current time and calls any scheduled
+         * callbacks whose deadlines have passed.
+         */
+        void Advance();
+
+        /**
+         * This method starts a worker thread which advances the wheel
+         * once per tick, until the Stop method is called or the
+         * wheel is destroyed.
+         */
+        void Start();
+
+        /**
+         * This method stops the worker thread started by the Start
+         * method, if it's running.  If called from a callback on the
+         * worker thread (including by destroying the wheel there),
+         * the worker thread is detached rather than joined, and exits
+         * once the callback returns.
+         */
+        void Stop();
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -9,6 +9,7 @@
 #include <Base64/Base64.hpp>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <SmtpAuth/Client.hpp>
 #include <sstream>
 #include <StringExtensions/StringExtensions.hpp>
@@ -26,6 +27,13 @@ namespace {
          */
         std::shared_ptr< Sasl::Client::Mechanism > impl;
 
+        /**
+         * If not null, this is the function to call to construct
+         * instances of the authentication mechanism, which are pooled
+         * rather than shared.  In this case, impl is not used.
+         */
+        std::shared_ptr< SmtpAuth::Client::MechanismFactory > factory;
+
         /**
          * This is used to select from multiple supported mechanisms,
          * where the one with the highest rank is selected.
@@ -33,6 +41,74 @@ namespace {
         int rank = 0;
     };
 
+    /**
+     * This holds the built-in challenge prediction for one
+     * SASL mechanism.
+     */
+    struct BuiltInChallengePrediction {
+        /**
+         * This is the name that the SMTP server recognizes for the
+         * mechanism.
+         */
+        const char* mechName;
+
+        /**
+         * This indicates whether or not the mechanism allows the
+         * client to send an initial response with the AUTH command.
+         */
+        bool initialResponseAllowed;
+
+        /**
+         * This is the first challenge the server will send for the
+         * mechanism, or null if it isn't known in advance.
+         */
+        const char* firstChallenge;
+    };
+
+    /**
+     * These are the challenge predictions built in for common
+     * SASL mechanisms.  The LOGIN mechanism doesn't formally define
+     * an initial response, but it's widely accepted as the response
+     * to the "Username:" challenge.
+     */
+    const BuiltInChallengePrediction BUILT_IN_CHALLENGE_PREDICTIONS[] = {
+        {"ANONYMOUS", true, nullptr},
+        {"EXTERNAL", true, nullptr},
+        {"LOGIN", true, "Username:"},
+        {"OAUTHBEARER", true, nullptr},
+        {"PLAIN", true, nullptr},
+        {"SCRAM-SHA-1", true, nullptr},
+        {"SCRAM-SHA-256", true, nullptr},
+        {"XOAUTH2", true, nullptr},
+    };
+
+    /**
+     * This is the type used to hold unused instances of SASL mechanisms
+     * made by registered factories, keyed by the factory which made them.
+     * Holding a reference to each factory ensures a pool is never
+     * mistaken for that of a different factory later made at the
+     * same address.  Entries are removed once they're empty, so that
+     * factories are only kept alive by pools holding unused instances.
+     */
+    typedef std::map<
+        std::shared_ptr< SmtpAuth::Client::MechanismFactory >,
+        std::vector< std::shared_ptr< Sasl::Client::Mechanism > >
+    > MechanismPool;
+
+    /**
+     * Return the pool of unused SASL mechanism instances belonging to
+     * the calling thread.  Since each thread has its own pool, no
+     * locking is needed to use it.
+     *
+     * @return
+     *     The pool of unused SASL mechanism instances belonging to
+     *     the calling thread is returned.
+     */
+    MechanismPool& GetThreadMechanismPool() {
+        thread_local MechanismPool pool;
+        return pool;
+    }
+
 }
 
 namespace SmtpAuth {
@@ -43,6 +119,19 @@ namespace SmtpAuth {
     struct Client::Impl {
         // Properties
 
+        /**
+         * This is used to synchronize access to the instance, since
+         * deadlines may pass in a different thread from the one
+         * used by the SMTP client.
+         */
+        std::mutex mutex;
+
+        /**
+         * This refers to the instance itself, so that scheduled
+         * callbacks can safely refer back to it.
+         */
+        std::weak_ptr< Impl > self;
+
         /**
          * This is a helper object used to generate and publish
          * diagnostic messages.
@@ -72,6 +161,31 @@ namespace SmtpAuth {
          */
         std::string selectedMechName;
 
+        /**
+         * If the selected mechanism was taken from a mechanism pool,
+         * this is the factory identifying the pool to which it must be
+         * returned when no longer needed.
+         */
+        std::shared_ptr< MechanismFactory > selectedMechFactory;
+
+        /**
+         * This is the information specific to the mechanism that
+         * the client uses to authenticate (e.g. certificate, ticket,
+         * password, etc.)
+         */
+        std::string credentials;
+
+        /**
+         * This is the identity to to associate with the credentials
+         * in the authentication.
+         */
+        std::string authenticationIdentity;
+
+        /**
+         * This is the identity to "act as" in the authentication.
+         */
+        std::string authorizationIdentity;
+
         /**
          * This is the function to call to unsubscribe from receiving
          * diagnostic messages from the selected SASL mechanism.
@@ -98,6 +212,110 @@ namespace SmtpAuth {
          */
         std::function< void(bool success) > onStageComplete;
 
+        /**
+         * This is the timer wheel used to schedule the deadlines
+         * of authentication exchanges, if any.
+         */
+        std::shared_ptr< TimerWheel > timerWheel;
+
+        /**
+         * This is the maximum amount of time, in seconds, allowed
+         * for a whole authentication exchange, or zero if there
+         * is no limit.
+         */
+        double exchangeTimeout = 0.0;
+
+        /**
+         * This is the maximum amount of time, in seconds, allowed
+         * for the server to reply to each message sent to it during
+         * an authentication exchange, or zero if there is no limit.
+         */
+        double stepTimeout = 0.0;
+
+        /**
+         * This identifies the scheduled deadline for the whole
+         * authentication exchange, or is zero if none is scheduled.
+         */
+        TimerWheel::Token exchangeTimerToken = 0;
+
+        /**
+         * This identifies the scheduled deadline for the current
+         * step of the authentication exchange, or is zero if none
+         * is scheduled.
+         */
+        TimerWheel::Token stepTimerToken = 0;
+
+        /**
+         * This identifies the scheduled retry of the authentication
+         * exchange, or is zero if none is scheduled.
+         */
+        TimerWheel::Token retryTimerToken = 0;
+
+        /**
+         * This is the policy used to decide whether and when to retry
+         * failed authentication exchanges, if any.
+         */
+        std::shared_ptr< RetryPolicy > retryPolicy;
+
+        /**
+         * This identifies the server to which the client is connected,
+         * for the sake of the retry policy.
+         */
+        std::string server;
+
+        /**
+         * This is the number of times the current authentication
+         * exchange has been retried within the session.
+         */
+        size_t retriesSoFar = 0;
+
+        /**
+         * This is the decision made by the retry policy for the most
+         * recent failed authentication exchange which wasn't retried
+         * within the session.
+         */
+        RetryPolicy::Decision retryDecision;
+
+        /**
+         * This is the classification of the most recent reply
+         * received from the server.
+         */
+        ReplyClassification lastReplyClassification;
+
+        /**
+         * This indicates whether or not the client tries to save
+         * round trips to the server.
+         */
+        bool minimizeRoundTrips = false;
+
+        /**
+         * This holds what is known in advance about how the server
+         * will challenge the client, keyed by the name that the SMTP
+         * server recognizes for each SASL mechanism.
+         */
+        std::map< std::string, Client::ChallengePrediction > challengePredictions;
+
+        /**
+         * These are the responses already sent for challenges predicted
+         * in advance, keyed by challenge.  If the server sends one of
+         * these challenges anyway, the same response is sent again,
+         * since the mechanism has already moved past it.
+         */
+        std::map< std::string, std::string > predictedResponses;
+
+        /**
+         * This is incremented whenever an authentication exchange begins
+         * or is reset, so that deadlines which pass after their
+         * exchanges are over can be recognized and ignored.
+         */
+        unsigned int exchangeGeneration = 0;
+
+        /**
+         * This is the reason why the most recent authentication
+         * exchange failed, if it did.
+         */
+        Client::FailureReason failureReason = Client::FailureReason::None;
+
         // Methods
 
         /**
@@ -106,40 +324,415 @@ namespace SmtpAuth {
         Impl()
             : diagnosticsSender("SmtpAuth")
         {
+            for (const auto& builtInPrediction: BUILT_IN_CHALLENGE_PREDICTIONS) {
+                auto& prediction = challengePredictions[builtInPrediction.mechName];
+                prediction.initialResponseAllowed = builtInPrediction.initialResponseAllowed;
+                if (builtInPrediction.firstChallenge != nullptr) {
+                    prediction.firstChallengeKnown = true;
+                    prediction.firstChallenge = builtInPrediction.firstChallenge;
+                }
+            }
+        }
+
+        /**
+         * This is the destructor of the structure.
+         */
+        ~Impl() noexcept {
+            CancelTimers();
+            if (selectedMechDiagnosticsUnsubscribeDelegate != nullptr) {
+                selectedMechDiagnosticsUnsubscribeDelegate();
+            }
+        }
+
+        /**
+         * Cancel the given scheduled deadline, if it's scheduled.
+         *
+         * @param[in,out] token
+         *     This identifies the deadline to cancel.  It's set to
+         *     zero once the deadline is cancelled.
+         */
+        void CancelTimer(TimerWheel::Token& token) {
+            if (token == 0) {
+                return;
+            }
+            timerWheel->Cancel(token);
+            token = 0;
+        }
+
+        /**
+         * Cancel all scheduled deadlines.
+         */
+        void CancelTimers() {
+            CancelTimer(exchangeTimerToken);
+            CancelTimer(stepTimerToken);
+            CancelTimer(retryTimerToken);
+        }
+
+        /**
+         * Schedule a function to be called for the current authentication
+         * exchange, replacing any function already scheduled with the
+         * same token.
+         *
+         * @param[in,out] token
+         *     This identifies the function already scheduled, if any.
+         *     It's set to identify the newly scheduled function.
+         *
+         * @param[in] delay
+         *     This is the amount of time, in seconds, to wait before
+         *     calling the function.
+         *
+         * @param[in] handler
+         *     This is the function to call, if the client still exists.
+         *     It's given the client, the exchange generation at the
+         *     time the function was scheduled, and the token which
+         *     identified it.  The timer wheel may call it even after
+         *     it's cancelled, if the wheel had already taken it out to
+         *     be called, so the handler should compare the token with
+         *     the one currently held by the client, under the lock.
+         */
+        void ScheduleTimer(
+            TimerWheel::Token& token,
+            double delay,
+            std::function<
+                void(
+                    Impl& impl,
+                    unsigned int generation,
+                    TimerWheel::Token token
+                )
+            > handler
+        ) {
+            CancelTimer(token);
+            std::weak_ptr< Impl > implWeak(self);
+            const auto generation = exchangeGeneration;
+            // The token isn't known until the function is scheduled, but
+            // the handler can't see it before then, since it has to wait
+            // for the lock held by the caller.
+            const auto scheduledToken = std::make_shared< TimerWheel::Token >(0);
+            token = timerWheel->Schedule(
+                delay,
+                [implWeak, generation, scheduledToken, handler]{
+                    const auto impl = implWeak.lock();
+                    if (impl == nullptr) {
+                        return;
+                    }
+                    handler(*impl, generation, *scheduledToken);
+                }
+            );
+            *scheduledToken = token;
+        }
+
+        /**
+         * Schedule a deadline for the current authentication exchange,
+         * replacing any deadline of the same kind already scheduled.
+         *
+         * @param[in,out] token
+         *     This identifies the deadline of the same kind already
+         *     scheduled, if any.  It's set to identify the new deadline.
+         *
+         * @param[in] timeout
+         *     This is the amount of time, in seconds, before the
+         *     deadline, or zero if there should be no deadline.
+         *
+         * @param[in] reason
+         *     This is the reason to give for the exchange failing
+         *     if the deadline passes.
+         */
+        void ScheduleDeadline(
+            TimerWheel::Token& token,
+            double timeout,
+            Client::FailureReason reason
+        ) {
+            CancelTimer(token);
+            if (
+                (timerWheel == nullptr)
+                || (timeout <= 0.0)
+            ) {
+                return;
+            }
+            ScheduleTimer(
+                token,
+                timeout,
+                [reason](
+                    Impl& impl,
+                    unsigned int generation,
+                    TimerWheel::Token token
+                ){
+                    impl.OnTimeout(generation, token, reason);
+                }
+            );
         }
 
         /**
-         * Handle the fact that the authentication stage is complete.
+         * Form the AUTH command which begins an authentication
+         * exchange using the selected mechanism.
+         *
+         * @return
+         *     The AUTH command to send to the server is returned.
          */
-        void OnDone(bool success) {
+        std::string BuildAuthCommand() {
+            predictedResponses.clear();
+            auto initialResponse = selectedMech->GetInitialResponse();
+            std::ostringstream messageBuilder;
+            messageBuilder << "AUTH " << selectedMechName;
+            if (!initialResponse.empty()) {
+                messageBuilder << ' ' << Base64::Encode(initialResponse);
+            } else if (minimizeRoundTrips) {
+                const auto challengePredictionsEntry = challengePredictions.find(selectedMechName);
+                if (
+                    (challengePredictionsEntry != challengePredictions.end())
+                    && challengePredictionsEntry->second.initialResponseAllowed
+                ) {
+                    // Without a known first challenge, the server would
+                    // send an empty one, so answer that in advance.
+                    const auto& prediction = challengePredictionsEntry->second;
+                    const auto firstChallenge = (
+                        prediction.firstChallengeKnown
+                        ? prediction.firstChallenge
+                        : ""
+                    );
+                    initialResponse = selectedMech->Proceed(firstChallenge);
+                    predictedResponses[firstChallenge] = initialResponse;
+                    if (initialResponse.empty()) {
+                        messageBuilder << " =";
+                    } else {
+                        messageBuilder << ' ' << Base64::Encode(initialResponse);
+                    }
+                }
+            }
+            messageBuilder << "\r\n";
+            return messageBuilder.str();
+        }
+
+        /**
+         * Check whether or not the circuit breaker of the retry policy,
+         * if any, allows an attempt to authenticate with the server.
+         * If not, the exchange is marked as failed.
+         *
+         * @return
+         *     An indication of whether or not the attempt is allowed
+         *     is returned.
+         */
+        bool CheckCircuitBreaker() {
+            if (
+                (retryPolicy == nullptr)
+                || retryPolicy->IsAttemptAllowed(server)
+            ) {
+                return true;
+            }
             done = true;
-            onStageComplete(success);
+            failureReason = Client::FailureReason::CircuitOpen;
+            retryDecision = RetryPolicy::Decision();
+            CancelTimers();
+            return false;
         }
 
         /**
-         * Find the highest ranked SASL mechanism registered that is also
-         * supported by the SMTP server.
+         * Handle the delay passing before retrying an authentication
+         * exchange, by sending the AUTH command again.
+         *
+         * @param[in] generation
+         *     This identifies the exchange to retry.
+         *
+         * @param[in] token
+         *     This identifies the scheduled retry.
          */
-        void SelectBestSupportedMechanism() {
+        void OnRetry(
+            unsigned int generation,
+            TimerWheel::Token token
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (
+                done
+                || (generation != exchangeGeneration)
+                || (token != retryTimerToken)
+                || (selectedMech == nullptr)
+            ) {
+                return;
+            }
+            retryTimerToken = 0;
+            if (!CheckCircuitBreaker()) {
+                const auto onStageCompleteCopy = onStageComplete;
+                lock.unlock();
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                    "circuit breaker open for server '%s'; not retrying authentication",
+                    server.c_str()
+                );
+                onStageCompleteCopy(false);
+                return;
+            }
+            failureReason = Client::FailureReason::None;
+            selectedMech->Reset();
+            const auto message = BuildAuthCommand();
+            ScheduleDeadline(
+                stepTimerToken,
+                stepTimeout,
+                Client::FailureReason::StepTimeout
+            );
+            const auto onSendMessageCopy = onSendMessage;
+            lock.unlock();
+            diagnosticsSender.SendDiagnosticInformationFormatted(
+                1,
+                "retrying authentication (retry %zu)",
+                retriesSoFar
+            );
+            onSendMessageCopy(message);
+        }
+
+        /**
+         * Handle a deadline passing for an authentication exchange,
+         * by cancelling the exchange (unless it's waiting to be retried,
+         * in which case there's no exchange open with the server) and
+         * completing the stage unsuccessfully.
+         *
+         * @param[in] generation
+         *     This identifies the exchange to which the deadline applies.
+         *
+         * @param[in] token
+         *     This identifies the deadline.
+         *
+         * @param[in] reason
+         *     This is the reason to give for the exchange failing.
+         */
+        void OnTimeout(
+            unsigned int generation,
+            TimerWheel::Token token,
+            Client::FailureReason reason
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto currentToken = (
+                (reason == Client::FailureReason::ExchangeTimeout)
+                ? exchangeTimerToken
+                : stepTimerToken
+            );
+            if (
+                done
+                || (generation != exchangeGeneration)
+                || (token != currentToken)
+            ) {
+                return;
+            }
+            done = true;
+            failureReason = reason;
+            // While waiting to retry, the server has already ended the
+            // AUTH command (and the failure has already been reported
+            // to the retry policy), so there's nothing to cancel.
+            const auto waitingToRetry = (retryTimerToken != 0);
+            CancelTimers();
+            if (
+                (retryPolicy != nullptr)
+                && !waitingToRetry
+            ) {
+                retryDecision = retryPolicy->ReportFailure(server, true, retriesSoFar);
+            }
+            const auto onSendMessageCopy = onSendMessage;
+            const auto onStageCompleteCopy = onStageComplete;
+            lock.unlock();
+            diagnosticsSender.SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "%s; %s authentication",
+                (
+                    (reason == Client::FailureReason::ExchangeTimeout)
+                    ? "authentication exchange timed out"
+                    : "timed out waiting for server reply"
+                ),
+                (waitingToRetry ? "not retrying" : "cancelling")
+            );
+            if (!waitingToRetry) {
+                onSendMessageCopy("*\r\n");
+            }
+            onStageCompleteCopy(false);
+        }
+
+        /**
+         * Stop using the selected SASL mechanism, if any, returning it
+         * to the mechanism pool if it was taken from there.
+         */
+        void ReleaseSelectedMechanism() {
             if (selectedMechDiagnosticsUnsubscribeDelegate != nullptr) {
                 selectedMechDiagnosticsUnsubscribeDelegate();
+                selectedMechDiagnosticsUnsubscribeDelegate = nullptr;
+            }
+            if (selectedMechFactory != nullptr) {
+                selectedMech->Reset();
+                selectedMech->SetCredentials("", "", "");
+                GetThreadMechanismPool()[selectedMechFactory].push_back(selectedMech);
             }
-            int selectedRank = 0;
             selectedMech = nullptr;
+            selectedMechFactory = nullptr;
+        }
+
+        /**
+         * Obtain an instance of the given registered SASL mechanism,
+         * either the instance registered directly, or one taken from the
+         * mechanism pool or made by the registered factory.
+         *
+         * @param[in] mechName
+         *     This is the name that the SMTP server recognizes for the
+         *     mechanism.
+         *
+         * @param[in] mech
+         *     This holds information about the registered mechanism.
+         */
+        void AcquireMechanism(
+            const std::string& mechName,
+            const Mechanism& mech
+        ) {
+            selectedMechName = mechName;
+            if (mech.factory == nullptr) {
+                selectedMech = mech.impl;
+                return;
+            }
+            auto& pool = GetThreadMechanismPool();
+            const auto poolEntry = pool.find(mech.factory);
+            if (poolEntry == pool.end()) {
+                selectedMech = (*mech.factory)();
+                if (selectedMech == nullptr) {
+                    diagnosticsSender.SendDiagnosticInformationFormatted(
+                        SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                        "factory for mechanism '%s' did not produce an instance",
+                        mechName.c_str()
+                    );
+                    return;
+                }
+            } else {
+                selectedMech = poolEntry->second.back();
+                poolEntry->second.pop_back();
+                if (poolEntry->second.empty()) {
+                    (void)pool.erase(poolEntry);
+                }
+            }
+            selectedMechFactory = mech.factory;
+            selectedMech->SetCredentials(
+                credentials,
+                authenticationIdentity,
+                authorizationIdentity
+            );
+        }
+
+        /**
+         * Find the highest ranked SASL mechanism registered that is also
+         * supported by the SMTP server.
+         */
+        void SelectBestSupportedMechanism() {
+            ReleaseSelectedMechanism();
+            std::map< std::string, Mechanism >::const_iterator selectedMechsEntry = mechs.end();
             for (const auto& supportedMech: supportedMechs) {
                 const auto mechsEntry = mechs.find(supportedMech);
                 if (mechsEntry == mechs.end()) {
                     continue;
                 }
                 if (
-                    (selectedMech == nullptr)
-                    || (mechsEntry->second.rank > selectedRank)
+                    (selectedMechsEntry == mechs.end())
+                    || (mechsEntry->second.rank > selectedMechsEntry->second.rank)
                 ) {
-                    selectedMechName = supportedMech;
-                    selectedMech = mechsEntry->second.impl;
-                    selectedRank = mechsEntry->second.rank;
+                    selectedMechsEntry = mechsEntry;
                 }
             }
+            if (selectedMechsEntry == mechs.end()) {
+                return;
+            }
+            AcquireMechanism(selectedMechsEntry->first, selectedMechsEntry->second);
             if (selectedMech != nullptr) {
                 selectedMechDiagnosticsUnsubscribeDelegate = selectedMech->SubscribeToDiagnostics(
                     diagnosticsSender.Chain()
@@ -155,6 +748,7 @@ namespace SmtpAuth {
     Client::Client()
         : impl_(new Impl)
     {
+        impl_->self = impl_;
     }
 
     SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate Client::SubscribeToDiagnostics(
@@ -171,6 +765,18 @@ namespace SmtpAuth {
     ) {
         auto& mech = impl_->mechs[mechName];
         mech.impl = mechImpl;
+        mech.factory = nullptr;
+        mech.rank = rank;
+    }
+
+    void Client::RegisterFactory(
+        const std::string& mechName,
+        int rank,
+        std::shared_ptr< MechanismFactory > mechFactory
+    ) {
+        auto& mech = impl_->mechs[mechName];
+        mech.impl = nullptr;
+        mech.factory = mechFactory;
         mech.rank = rank;
     }
 
@@ -179,13 +785,76 @@ namespace SmtpAuth {
         const std::string& authenticationIdentity,
         const std::string& authorizationIdentity
     ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->credentials = credentials;
+        impl_->authenticationIdentity = authenticationIdentity;
+        impl_->authorizationIdentity = authorizationIdentity;
         for (auto& mech: impl_->mechs) {
+            if (mech.second.impl == nullptr) {
+                continue;
+            }
             mech.second.impl->SetCredentials(
                 credentials,
                 authenticationIdentity,
                 authorizationIdentity
             );
         }
+        if (impl_->selectedMechFactory != nullptr) {
+            impl_->selectedMech->SetCredentials(
+                credentials,
+                authenticationIdentity,
+                authorizationIdentity
+            );
+        }
+    }
+
+    void Client::SetTimeouts(
+        std::shared_ptr< TimerWheel > timerWheel,
+        double exchangeTimeout,
+        double stepTimeout
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->CancelTimers();
+        impl_->timerWheel = timerWheel;
+        impl_->exchangeTimeout = exchangeTimeout;
+        impl_->stepTimeout = stepTimeout;
+    }
+
+    auto Client::GetFailureReason() const -> FailureReason {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->failureReason;
+    }
+
+    void Client::SetRetryPolicy(
+        std::shared_ptr< RetryPolicy > retryPolicy,
+        const std::string& server
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->retryPolicy = retryPolicy;
+        impl_->server = server;
+    }
+
+    ReplyClassification Client::GetLastReplyClassification() const {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->lastReplyClassification;
+    }
+
+    RetryPolicy::Decision Client::GetRetryDecision() const {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->retryDecision;
+    }
+
+    void Client::SetMinimizeRoundTrips(bool minimizeRoundTrips) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->minimizeRoundTrips = minimizeRoundTrips;
+    }
+
+    void Client::SetChallengePrediction(
+        const std::string& mechName,
+        const ChallengePrediction& prediction
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->challengePredictions[mechName] = prediction;
     }
 
     void Client::Configure(const std::string& parameters) {
@@ -193,7 +862,14 @@ namespace SmtpAuth {
     }
 
     void Client::Reset() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->CancelTimers();
+        ++impl_->exchangeGeneration;
+        impl_->ReleaseSelectedMechanism();
         for (auto& mech: impl_->mechs) {
+            if (mech.second.impl == nullptr) {
+                continue;
+            }
             mech.second.impl->Reset();
         }
         impl_->done = false;
@@ -202,6 +878,7 @@ namespace SmtpAuth {
     bool Client::IsExtraProtocolStageNeededHere(
         const Smtp::Client::MessageContext& context
     ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
         if (
             impl_->done
             || (context.protocolStage != Smtp::Client::ProtocolStage::ReadyToSend)
@@ -216,22 +893,56 @@ namespace SmtpAuth {
         std::function< void(const std::string& data) > onSendMessage,
         std::function< void(bool success) > onStageComplete
     ) {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
         impl_->onSendMessage = onSendMessage;
         impl_->onStageComplete = onStageComplete;
-        const auto initialResponse = impl_->selectedMech->GetInitialResponse();
-        std::ostringstream messageBuilder;
-        messageBuilder << "AUTH " << impl_->selectedMechName;
-        if (!initialResponse.empty()) {
-            messageBuilder << ' ' << Base64::Encode(initialResponse);
+        impl_->failureReason = FailureReason::None;
+        impl_->retriesSoFar = 0;
+        impl_->retryDecision = RetryPolicy::Decision();
+        impl_->lastReplyClassification = ReplyClassification();
+        ++impl_->exchangeGeneration;
+        if (!impl_->CheckCircuitBreaker()) {
+            lock.unlock();
+            impl_->diagnosticsSender.SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "circuit breaker open for server '%s'; not authenticating",
+                impl_->server.c_str()
+            );
+            onStageComplete(false);
+            return;
         }
-        messageBuilder << "\r\n";
-        onSendMessage(messageBuilder.str());
+        const auto message = impl_->BuildAuthCommand();
+        impl_->ScheduleDeadline(
+            impl_->exchangeTimerToken,
+            impl_->exchangeTimeout,
+            FailureReason::ExchangeTimeout
+        );
+        impl_->ScheduleDeadline(
+            impl_->stepTimerToken,
+            impl_->stepTimeout,
+            FailureReason::StepTimeout
+        );
+        lock.unlock();
+        onSendMessage(message);
     }
 
     bool Client::HandleServerMessage(
         const Smtp::Client::MessageContext& context,
         const Smtp::Client::ParsedMessage& message
     ) {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->done) { // exchange already over (e.g. timed out)
+            impl_->diagnosticsSender.SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "S: %d%c%s (ignored; authentication exchange is over)",
+                message.code,
+                message.last ? ' ' : '-',
+                message.text.c_str()
+            );
+            return false;
+        }
+        impl_->CancelTimer(impl_->stepTimerToken);
+        impl_->lastReplyClassification = ClassifyReply(message);
         switch (message.code) {
             case 235: { // successfully authenticated
                 impl_->diagnosticsSender.SendDiagnosticInformationFormatted(
@@ -241,7 +952,14 @@ namespace SmtpAuth {
                     message.last ? ' ' : '-',
                     message.text.c_str()
                 );
-                impl_->OnDone(true);
+                impl_->done = true;
+                impl_->CancelTimers();
+                if (impl_->retryPolicy != nullptr) {
+                    impl_->retryPolicy->ReportSuccess(impl_->server);
+                }
+                const auto onStageComplete = impl_->onStageComplete;
+                lock.unlock();
+                onStageComplete(true);
             } break;
 
             case 334: { // continue request
@@ -253,13 +971,31 @@ namespace SmtpAuth {
                     message.last ? ' ' : '-',
                     decodedText.c_str()
                 );
-                const auto response = impl_->selectedMech->Proceed(
-                    decodedText
-                );
+                std::string response;
+                const auto predictedResponsesEntry = impl_->predictedResponses.find(decodedText);
+                if (predictedResponsesEntry == impl_->predictedResponses.end()) {
+                    response = impl_->selectedMech->Proceed(
+                        decodedText
+                    );
+                } else {
+                    impl_->diagnosticsSender.SendDiagnosticInformationFormatted(
+                        1,
+                        "server sent predicted challenge anyway; sending same response again"
+                    );
+                    response = predictedResponsesEntry->second;
+                    impl_->predictedResponses.erase(predictedResponsesEntry);
+                }
                 std::ostringstream messageBuilder;
                 messageBuilder << Base64::Encode(response);
                 messageBuilder << "\r\n";
-                impl_->onSendMessage(messageBuilder.str());
+                impl_->ScheduleDeadline(
+                    impl_->stepTimerToken,
+                    impl_->stepTimeout,
+                    FailureReason::StepTimeout
+                );
+                const auto onSendMessage = impl_->onSendMessage;
+                lock.unlock();
+                onSendMessage(messageBuilder.str());
             } break;
 
             default: { // something bad happened; FeelsBadMan
@@ -270,6 +1006,48 @@ namespace SmtpAuth {
                     message.last ? ' ' : '-',
                     message.text.c_str()
                 );
+                impl_->failureReason = FailureReason::Rejected;
+                if (impl_->retryPolicy != nullptr) {
+                    // If the server is closing the connection, the failure
+                    // is still transient, but the attempt can only be
+                    // retried by the caller, with a new connection.
+                    const auto closingConnection = (message.code == 421);
+                    const auto decision = impl_->retryPolicy->ReportFailure(
+                        impl_->server,
+                        (
+                            impl_->lastReplyClassification.retryable
+                            || closingConnection
+                        ),
+                        impl_->retriesSoFar
+                    );
+                    if (
+                        decision.retry
+                        && !closingConnection
+                        && (impl_->timerWheel != nullptr)
+                    ) {
+                        ++impl_->retriesSoFar;
+                        impl_->diagnosticsSender.SendDiagnosticInformationFormatted(
+                            1,
+                            "transient failure; will retry in %.3lf seconds",
+                            decision.delay
+                        );
+                        impl_->ScheduleTimer(
+                            impl_->retryTimerToken,
+                            decision.delay,
+                            [](
+                                Impl& impl,
+                                unsigned int generation,
+                                TimerWheel::Token token
+                            ){
+                                impl.OnRetry(generation, token);
+                            }
+                        );
+                        return true;
+                    }
+                    impl_->retryDecision = decision;
+                }
+                impl_->done = true;
+                impl_->CancelTimers();
             } return false;
         }
         return true;
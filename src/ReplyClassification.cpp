@@ -0,0 +1,152 @@
+/**
+ * @file ReplyClassification.cpp
+ *
+ * This module contains the implementation of the SmtpAuth::ClassifyReply
+ * function.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <SmtpAuth/ReplyClassification.hpp>
+#include <string>
+
+namespace {
+
+    /**
+     * Parse one part of an enhanced status code, which is a decimal
+     * number of one to three digits.
+     *
+     * @param[in] text
+     *     This is the text containing the enhanced status code.
+     *
+     * @param[in,out] position
+     *     This is the position in the text where the part begins.
+     *     On success, it's moved to just past the end of the part.
+     *
+     * @param[out] value
+     *     This is where to store the value of the part.
+     *
+     * @return
+     *     An indication of whether or not the part was parsed
+     *     successfully is returned.
+     */
+    bool ParseEnhancedStatusCodePart(
+        const std::string& text,
+        size_t& position,
+        int& value
+    ) {
+        value = 0;
+        size_t digits = 0;
+        while (
+            (position < text.length())
+            && (text[position] >= '0')
+            && (text[position] <= '9')
+        ) {
+            if (++digits > 3) {
+                return false;
+            }
+            value *= 10;
+            value += (int)(text[position++] - '0');
+        }
+        return (digits > 0);
+    }
+
+    /**
+     * Parse the enhanced status code at the beginning of the given
+     * reply text, if there is one.
+     *
+     * @param[in] text
+     *     This is the text of the reply.
+     *
+     * @param[in,out] classification
+     *     This is where to store the enhanced status code, if found.
+     */
+    void ParseEnhancedStatusCode(
+        const std::string& text,
+        SmtpAuth::ReplyClassification& classification
+    ) {
+        size_t position = 0;
+        int statusClass, subject, detail;
+        if (
+            !ParseEnhancedStatusCodePart(text, position, statusClass)
+            || (position >= text.length())
+            || (text[position++] != '.')
+            || !ParseEnhancedStatusCodePart(text, position, subject)
+            || (position >= text.length())
+            || (text[position++] != '.')
+            || !ParseEnhancedStatusCodePart(text, position, detail)
+            || (
+                (position < text.length())
+                && (text[position] != ' ')
+            )
+        ) {
+            return;
+        }
+        if (
+            (statusClass != 2)
+            && (statusClass != 4)
+            && (statusClass != 5)
+        ) {
+            return;
+        }
+        classification.hasEnhancedStatusCode = true;
+        classification.enhancedStatusClass = statusClass;
+        classification.enhancedStatusSubject = subject;
+        classification.enhancedStatusDetail = detail;
+    }
+
+}
+
+namespace SmtpAuth {
+
+    ReplyClassification ClassifyReply(const Smtp::Client::ParsedMessage& message) {
+        ReplyClassification classification;
+        classification.code = message.code;
+        ParseEnhancedStatusCode(message.text, classification);
+        switch (message.code / 100) {
+            case 2: {
+                classification.severity = ReplyClassification::Severity::Success;
+            } break;
+
+            case 3: {
+                classification.severity = ReplyClassification::Severity::Intermediate;
+            } break;
+
+            case 4: {
+                classification.severity = ReplyClassification::Severity::Transient;
+            } break;
+
+            case 5: {
+                classification.severity = ReplyClassification::Severity::Permanent;
+            } break;
+
+            default: { // unrecognized reply code; fall back to enhanced status code
+                if (
+                    classification.hasEnhancedStatusCode
+                    && (classification.enhancedStatusClass == 4)
+                ) {
+                    classification.severity = ReplyClassification::Severity::Transient;
+                } else {
+                    classification.severity = ReplyClassification::Severity::Permanent;
+                }
+            } break;
+        }
+        classification.retryable = (
+            (classification.severity == ReplyClassification::Severity::Transient)
+            && (classification.code != 421) // server closing connection
+            && (classification.code != 432) // password transition needed
+            && !(
+                classification.hasEnhancedStatusCode
+                && (
+                    (classification.enhancedStatusClass == 5)
+                    || (
+                        (classification.enhancedStatusSubject == 7)
+                        && (classification.enhancedStatusDetail == 12)
+                    )
+                )
+            )
+        );
+        return classification;
+    }
+
+}
@@ -0,0 +1,217 @@
+/**
+ * @file RetryPolicy.cpp
+ *
+ * This module contains the implementation of the SmtpAuth::RetryPolicy class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <random>
+#include <SmtpAuth/RetryPolicy.hpp>
+#include <SmtpAuth/SteadyTimeKeeper.hpp>
+
+namespace {
+
+    /**
+     * These are the states of a circuit breaker.
+     */
+    enum class BreakerState {
+        /**
+         * Attempts are allowed.
+         */
+        Closed,
+
+        /**
+         * Attempts are refused until the cool-down period has passed.
+         */
+        Open,
+
+        /**
+         * One trial attempt has been allowed, and further attempts are
+         * refused until its outcome is reported.
+         */
+        HalfOpen,
+    };
+
+    /**
+     * This holds the circuit breaker state of one server.
+     */
+    struct Breaker {
+        /**
+         * This is the current state of the breaker.
+         */
+        BreakerState state = BreakerState::Closed;
+
+        /**
+         * This is the number of transient failures reported for
+         * the server since the last success.
+         */
+        size_t consecutiveFailures = 0;
+
+        /**
+         * This is the time at which the breaker last opened or
+         * allowed a trial attempt.
+         */
+        double lastStateChangeTime = 0.0;
+    };
+
+}
+
+namespace SmtpAuth {
+
+    /**
+     * This contains the private properties of a RetryPolicy instance.
+     */
+    struct RetryPolicy::Impl {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the policy.
+         */
+        std::mutex mutex;
+
+        /**
+         * This holds the settings which control the policy.
+         */
+        Configuration configuration;
+
+        /**
+         * This is the object used to track time.
+         */
+        std::shared_ptr< TimeKeeper > timeKeeper;
+
+        /**
+         * This is used to generate the random jitter added to
+         * retry delays.
+         */
+        std::mt19937 generator;
+
+        /**
+         * These are the circuit breakers of all servers for which
+         * attempts have been reported, keyed by server.
+         */
+        std::map< std::string, Breaker > breakers;
+
+        // Methods
+
+        /**
+         * Return the delay before the given retry, chosen uniformly at
+         * random between zero and an upper bound which grows
+         * exponentially with the number of retries so far.
+         *
+         * @param[in] retriesSoFar
+         *     This is the number of times the attempt has already
+         *     been retried.
+         *
+         * @return
+         *     The delay before the retry, in seconds, is returned.
+         */
+        double GetRetryDelay(size_t retriesSoFar) {
+            const auto bound = std::min(
+                configuration.maxDelay,
+                configuration.baseDelay * pow(2.0, (double)std::min(retriesSoFar, (size_t)62))
+            );
+            std::uniform_real_distribution< double > distribution(0.0, bound);
+            return distribution(generator);
+        }
+    };
+
+    RetryPolicy::~RetryPolicy() noexcept = default;
+    RetryPolicy::RetryPolicy(RetryPolicy&& other) noexcept = default;
+    RetryPolicy& RetryPolicy::operator=(RetryPolicy&& other) noexcept = default;
+
+    RetryPolicy::RetryPolicy()
+        : RetryPolicy(Configuration())
+    {
+    }
+
+    RetryPolicy::RetryPolicy(
+        const Configuration& configuration,
+        std::shared_ptr< TimeKeeper > timeKeeper
+    )
+        : impl_(new Impl)
+    {
+        if (timeKeeper == nullptr) {
+            timeKeeper = std::make_shared< SteadyTimeKeeper >();
+        }
+        impl_->configuration = configuration;
+        impl_->timeKeeper = timeKeeper;
+        impl_->generator.seed(std::random_device()());
+    }
+
+    bool RetryPolicy::IsAttemptAllowed(const std::string& server) {
+        const auto now = impl_->timeKeeper->GetCurrentTime();
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& breaker = impl_->breakers[server];
+        switch (breaker.state) {
+            case BreakerState::Closed: {
+            } return true;
+
+            case BreakerState::Open:
+            case BreakerState::HalfOpen: { // a lost trial counts as failed
+                if (now - breaker.lastStateChangeTime < impl_->configuration.openDuration) {
+                    return false;
+                }
+                breaker.state = BreakerState::HalfOpen;
+                breaker.lastStateChangeTime = now;
+            } return true;
+
+            default: {
+            } return false;
+        }
+    }
+
+    void RetryPolicy::ReportSuccess(const std::string& server) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& breaker = impl_->breakers[server];
+        breaker.state = BreakerState::Closed;
+        breaker.consecutiveFailures = 0;
+    }
+
+    auto RetryPolicy::ReportFailure(
+        const std::string& server,
+        bool transient,
+        size_t retriesSoFar
+    ) -> Decision {
+        const auto now = impl_->timeKeeper->GetCurrentTime();
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& breaker = impl_->breakers[server];
+        Decision decision;
+        if (!transient) {
+            breaker.state = BreakerState::Closed;
+            breaker.consecutiveFailures = 0;
+            return decision;
+        }
+        ++breaker.consecutiveFailures;
+        if (
+            (breaker.state == BreakerState::Open)
+            && (now - breaker.lastStateChangeTime >= impl_->configuration.openDuration)
+        ) {
+            breaker.state = BreakerState::HalfOpen;
+        }
+        if (
+            (breaker.state == BreakerState::HalfOpen)
+            || (
+                (breaker.state == BreakerState::Closed)
+                && (breaker.consecutiveFailures >= impl_->configuration.failureThreshold)
+            )
+        ) {
+            breaker.state = BreakerState::Open;
+            breaker.lastStateChangeTime = now;
+        }
+        if (
+            (breaker.state == BreakerState::Open)
+            || (retriesSoFar >= impl_->configuration.maxRetries)
+        ) {
+            return decision;
+        }
+        decision.retry = true;
+        decision.delay = impl_->GetRetryDelay(retriesSoFar);
+        return decision;
+    }
+
+}
@@ -0,0 +1,21 @@
+/**
+ * @file SteadyTimeKeeper.cpp
+ *
+ * This module contains the implementation of the SmtpAuth::SteadyTimeKeeper
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <SmtpAuth/SteadyTimeKeeper.hpp>
+
+namespace SmtpAuth {
+
+    double SteadyTimeKeeper::GetCurrentTime() {
+        return std::chrono::duration< double >(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+    }
+
+}
@@ -0,0 +1,294 @@
+/**
+ * @file TimerWheel.cpp
+ *
+ * This module contains the implementation of the SmtpAuth::TimerWheel class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <SmtpAuth/SteadyTimeKeeper.hpp>
+#include <SmtpAuth/TimerWheel.hpp>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    /**
+     * This holds information about one scheduled callback.
+     */
+    struct Timer {
+        /**
+         * This is the time at which the callback should be called.
+         */
+        double deadline = 0.0;
+
+        /**
+         * This is the function to call once the deadline has passed.
+         */
+        std::function< void() > callback;
+    };
+
+}
+
+namespace SmtpAuth {
+
+    /**
+     * This contains the private properties of a TimerWheel instance.
+     */
+    struct TimerWheel::Impl {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the wheel.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the object used to track time.
+         */
+        std::shared_ptr< TimeKeeper > timeKeeper;
+
+        /**
+         * This is the amount of time, in seconds, covered by
+         * each slot of the wheel.
+         */
+        double tickDuration = 0.1;
+
+        /**
+         * These are the slots of the wheel.  Each holds the callbacks
+         * whose deadlines fall into the ticks which map to the slot,
+         * keyed by the tokens identifying them.
+         */
+        std::vector< std::map< Token, Timer > > slots;
+
+        /**
+         * This maps the token of each scheduled callback to the index
+         * of the slot holding it.
+         */
+        std::map< Token, size_t > slotIndexesByToken;
+
+        /**
+         * This is the token to assign to the next scheduled callback.
+         */
+        Token nextToken = 1;
+
+        /**
+         * This is the most recent tick processed by the wheel.
+         */
+        long long lastTick = 0;
+
+        /**
+         * This is the thread which advances the wheel once per tick,
+         * if started.
+         */
+        std::thread worker;
+
+        /**
+         * This flag is set to tell the worker thread to stop.
+         */
+        bool stopWorker = false;
+
+        /**
+         * This is used to wake up the worker thread when it
+         * should stop.
+         */
+        std::condition_variable wakeWorker;
+
+        // Methods
+
+        /**
+         * Return the index of the first tick which begins at or after
+         * the given deadline.  Any callback placed in the slot for the
+         * returned tick will have its deadline passed once the tick
+         * is processed.
+         *
+         * @param[in] deadline
+         *     This is the deadline for which to find the tick.
+         *
+         * @return
+         *     The index of the first tick which begins at or after
+         *     the given deadline is returned.
+         */
+        long long GetDeadlineTick(double deadline) const {
+            return (long long)ceil(deadline / tickDuration);
+        }
+
+        /**
+         * Return the index of the last tick which begins at or before
+         * the given time.  This is the most recent tick which may be
+         * processed at the given time.
+         *
+         * @param[in] time
+         *     This is the time for which to find the tick.
+         *
+         * @return
+         *     The index of the last tick which begins at or before
+         *     the given time is returned.
+         */
+        long long GetCurrentTick(double time) const {
+            return (long long)floor(time / tickDuration);
+        }
+
+        /**
+         * Check the current time and call any scheduled callbacks
+         * whose deadlines have passed.
+         */
+        void Advance() {
+            const auto now = timeKeeper->GetCurrentTime();
+            std::vector< std::function< void() > > expiredCallbacks;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                const auto currentTick = GetCurrentTick(now);
+                const auto numSlots = (long long)slots.size();
+                const auto ticksToProcess = std::min(
+                    currentTick - lastTick,
+                    numSlots
+                );
+                for (long long i = 1; i <= ticksToProcess; ++i) {
+                    auto& slot = slots[
+                        (size_t)((lastTick + i) % numSlots)
+                    ];
+                    for (auto slotEntry = slot.begin(); slotEntry != slot.end();) {
+                        if (slotEntry->second.deadline <= now) {
+                            expiredCallbacks.push_back(slotEntry->second.callback);
+                            (void)slotIndexesByToken.erase(slotEntry->first);
+                            slotEntry = slot.erase(slotEntry);
+                        } else {
+                            ++slotEntry;
+                        }
+                    }
+                }
+                if (currentTick > lastTick) {
+                    lastTick = currentTick;
+                }
+            }
+            for (const auto& callback: expiredCallbacks) {
+                callback();
+            }
+        }
+
+        /**
+         * This is the body of the worker thread.
+         */
+        void Worker() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            while (!stopWorker) {
+                (void)wakeWorker.wait_for(
+                    lock,
+                    std::chrono::duration< double >(tickDuration),
+                    [this]{ return stopWorker; }
+                );
+                if (stopWorker) {
+                    break;
+                }
+                lock.unlock();
+                Advance();
+                lock.lock();
+            }
+        }
+    };
+
+    TimerWheel::~TimerWheel() noexcept {
+        if (impl_ != nullptr) {
+            Stop();
+        }
+    }
+    TimerWheel::TimerWheel(TimerWheel&& other) noexcept = default;
+    TimerWheel& TimerWheel::operator=(TimerWheel&& other) noexcept {
+        if (impl_ != nullptr) {
+            Stop();
+        }
+        impl_ = std::move(other.impl_);
+        return *this;
+    }
+
+    TimerWheel::TimerWheel(
+        std::shared_ptr< TimeKeeper > timeKeeper,
+        double tickDuration,
+        size_t numSlots
+    )
+        : impl_(new Impl)
+    {
+        if (timeKeeper == nullptr) {
+            timeKeeper = std::make_shared< SteadyTimeKeeper >();
+        }
+        impl_->timeKeeper = timeKeeper;
+        impl_->tickDuration = tickDuration;
+        impl_->slots.resize((numSlots == 0) ? 1 : numSlots);
+        impl_->lastTick = impl_->GetCurrentTick(timeKeeper->GetCurrentTime());
+    }
+
+    double TimerWheel::GetCurrentTime() {
+        return impl_->timeKeeper->GetCurrentTime();
+    }
+
+    auto TimerWheel::Schedule(
+        double timeout,
+        std::function< void() > callback
+    ) -> Token {
+        const auto deadline = impl_->timeKeeper->GetCurrentTime() + timeout;
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto tick = impl_->GetDeadlineTick(deadline);
+        if (tick <= impl_->lastTick) {
+            tick = impl_->lastTick + 1;
+        }
+        const auto slotIndex = (size_t)(tick % (long long)impl_->slots.size());
+        const auto token = impl_->nextToken++;
+        if (impl_->nextToken <= 0) {
+            impl_->nextToken = 1;
+        }
+        auto& timer = impl_->slots[slotIndex][token];
+        timer.deadline = deadline;
+        timer.callback = callback;
+        impl_->slotIndexesByToken[token] = slotIndex;
+        return token;
+    }
+
+    void TimerWheel::Cancel(Token token) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto slotIndexesByTokenEntry = impl_->slotIndexesByToken.find(token);
+        if (slotIndexesByTokenEntry == impl_->slotIndexesByToken.end()) {
+            return;
+        }
+        (void)impl_->slots[slotIndexesByTokenEntry->second].erase(token);
+        impl_->slotIndexesByToken.erase(slotIndexesByTokenEntry);
+    }
+
+    void TimerWheel::Advance() {
+        impl_->Advance();
+    }
+
+    void TimerWheel::Start() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->worker.joinable()) {
+            return;
+        }
+        impl_->stopWorker = false;
+        impl_->worker = std::thread(&Impl::Worker, impl_);
+    }
+
+    void TimerWheel::Stop() {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (!impl_->worker.joinable()) {
+            return;
+        }
+        impl_->stopWorker = true;
+        impl_->wakeWorker.notify_all();
+        if (impl_->worker.get_id() == std::this_thread::get_id()) {
+            // Stopped from a callback, so the worker can't be joined.
+            // It holds its own reference to the private properties,
+            // so it's safe to let it finish on its own.
+            impl_->worker.detach();
+            return;
+        }
+        lock.unlock();
+        impl_->worker.join();
+    }
+
+}
@@ -10,8 +10,10 @@
 #include <gtest/gtest.h>
 #include <Sasl/Client/Mechanism.hpp>
 #include <SmtpAuth/Client.hpp>
+#include <SmtpAuth/TimerWheel.hpp>
 #include <string>
 #include <vector>
+#include "MockTimeKeeper.hpp"
 
 namespace {
 
@@ -27,6 +29,8 @@ namespace {
         std::string initialResponse;
         std::string username;
         std::string password;
+        std::string proceedResponse = "LetMeIn";
+        std::vector< std::string > challengesReceived;
         bool wasReset = false;
 
         // Methods
@@ -63,7 +67,8 @@ namespace {
         }
 
         virtual std::string Proceed(const std::string& message) override {
-            return "LetMeIn";
+            challengesReceived.push_back(message);
+            return proceedResponse;
         }
 
         virtual bool Succeeded() override {
@@ -91,8 +96,11 @@ struct ClientTests
     SmtpAuth::Client auth;
     Smtp::Client::MessageContext context;
     std::vector< std::string > messagesSent;
+    std::shared_ptr< MockTimeKeeper > timeKeeper = std::make_shared< MockTimeKeeper >();
+    std::shared_ptr< SmtpAuth::TimerWheel > timerWheel = std::make_shared< SmtpAuth::TimerWheel >(timeKeeper, 0.5, 16);
     bool done = false;
     bool success = false;
+    bool lastHandleServerMessageResult = false;
 
     // Methods
 
@@ -112,6 +120,27 @@ struct ClientTests
         );
     }
 
+    void AdvanceTime(double amount) {
+        timeKeeper->currentTime += amount;
+        timerWheel->Advance();
+    }
+
+    void SendRejection(int code, const std::string& text) {
+        Smtp::Client::ParsedMessage parsedMessage;
+        parsedMessage.code = code;
+        parsedMessage.last = true;
+        parsedMessage.text = text;
+        lastHandleServerMessageResult = auth.HandleServerMessage(context, parsedMessage);
+    }
+
+    void SendContinueRequest() {
+        Smtp::Client::ParsedMessage parsedMessage;
+        parsedMessage.code = 334;
+        parsedMessage.last = true;
+        parsedMessage.text = Base64::Encode("Password:");
+        (void)auth.HandleServerMessage(context, parsedMessage);
+    }
+
     // ::testing::Test
 
     virtual void SetUp() override {
@@ -323,3 +352,715 @@ TEST_F(ClientTests, SecondAuthenticationAfterReset) {
     auth.Reset();
     EXPECT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
 }
+
+TEST_F(ClientTests, FactoryOnlyUsedForSelectedMechanism) {
+    size_t spamInstancesMade = 0;
+    size_t hamInstancesMade = 0;
+    auth.RegisterFactory(
+        "SPAM",
+        3,
+        std::make_shared< SmtpAuth::Client::MechanismFactory >(
+            [&spamInstancesMade]{
+                ++spamInstancesMade;
+                return std::make_shared< MockSaslMechanism >("Kappa");
+            }
+        )
+    );
+    auth.RegisterFactory(
+        "HAM",
+        4,
+        std::make_shared< SmtpAuth::Client::MechanismFactory >(
+            [&hamInstancesMade]{
+                ++hamInstancesMade;
+                return std::make_shared< MockSaslMechanism >("Keepo");
+            }
+        )
+    );
+    auth.Configure("FOO SPAM");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH SPAM " + Base64::Encode("Kappa") + "\r\n"
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(1, spamInstancesMade);
+    EXPECT_EQ(0, hamInstancesMade);
+}
+
+TEST_F(ClientTests, PooledMechanismReturnedOnResetAndReused) {
+    std::vector< std::shared_ptr< MockSaslMechanism > > instancesMade;
+    const auto factory = std::make_shared< SmtpAuth::Client::MechanismFactory >(
+        [&instancesMade]{
+            const auto instance = std::make_shared< MockSaslMechanism >("Kappa");
+            instancesMade.push_back(instance);
+            return instance;
+        }
+    );
+    auth.RegisterFactory("SPAM", 3, factory);
+    auth.Configure("SPAM");
+    auth.SetCredentials("hunter2", "alex");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    ASSERT_EQ(1, instancesMade.size());
+    EXPECT_EQ("hunter2", instancesMade[0]->password);
+    EXPECT_EQ("alex", instancesMade[0]->username);
+    auth.Reset();
+    EXPECT_TRUE(instancesMade[0]->wasReset);
+    EXPECT_EQ("", instancesMade[0]->password);
+    EXPECT_EQ("", instancesMade[0]->username);
+    instancesMade[0]->wasReset = false;
+    SmtpAuth::Client auth2;
+    auth2.RegisterFactory("SPAM", 3, factory);
+    auth2.Configure("SPAM");
+    auth2.SetCredentials("swordfish", "bob");
+    ASSERT_TRUE(auth2.IsExtraProtocolStageNeededHere(context));
+    EXPECT_EQ(1, instancesMade.size());
+    EXPECT_EQ("swordfish", instancesMade[0]->password);
+    EXPECT_EQ("bob", instancesMade[0]->username);
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    EXPECT_EQ(2, instancesMade.size());
+    EXPECT_EQ("hunter2", instancesMade[1]->password);
+    EXPECT_EQ("alex", instancesMade[1]->username);
+}
+
+TEST_F(ClientTests, PooledMechanismNotSharedBetweenFactories) {
+    size_t spamInstancesMade = 0;
+    size_t otherSpamInstancesMade = 0;
+    auth.RegisterFactory(
+        "SPAM",
+        3,
+        std::make_shared< SmtpAuth::Client::MechanismFactory >(
+            [&spamInstancesMade]{
+                ++spamInstancesMade;
+                return std::make_shared< MockSaslMechanism >("Kappa");
+            }
+        )
+    );
+    auth.Configure("SPAM");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    auth.Reset();
+    SmtpAuth::Client auth2;
+    auth2.RegisterFactory(
+        "SPAM",
+        3,
+        std::make_shared< SmtpAuth::Client::MechanismFactory >(
+            [&otherSpamInstancesMade]{
+                ++otherSpamInstancesMade;
+                return std::make_shared< MockSaslMechanism >("Keepo");
+            }
+        )
+    );
+    auth2.Configure("SPAM");
+    ASSERT_TRUE(auth2.IsExtraProtocolStageNeededHere(context));
+    EXPECT_EQ(1, spamInstancesMade);
+    EXPECT_EQ(1, otherSpamInstancesMade);
+}
+
+TEST_F(ClientTests, PooledMechanismDroppedOnDestruction) {
+    size_t instancesMade = 0;
+    const auto factory = std::make_shared< SmtpAuth::Client::MechanismFactory >(
+        [&instancesMade]{
+            ++instancesMade;
+            return std::make_shared< MockSaslMechanism >("Kappa");
+        }
+    );
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    {
+        SmtpAuth::Client auth2;
+        auth2.RegisterFactory("SPAM", 1, factory);
+        auth2.Configure("SPAM");
+        ASSERT_TRUE(auth2.IsExtraProtocolStageNeededHere(context));
+    }
+    SmtpAuth::Client auth3;
+    auth3.RegisterFactory("SPAM", 1, factory);
+    auth3.Configure("SPAM");
+    ASSERT_TRUE(auth3.IsExtraProtocolStageNeededHere(context));
+    EXPECT_EQ(2, instancesMade);
+}
+
+TEST_F(ClientTests, FactoryReleasedByPoolOnceInstancesTaken) {
+    auto factory = std::make_shared< SmtpAuth::Client::MechanismFactory >(
+        []{
+            return std::make_shared< MockSaslMechanism >("Kappa");
+        }
+    );
+    std::weak_ptr< SmtpAuth::Client::MechanismFactory > factoryWeak(factory);
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    {
+        SmtpAuth::Client auth2;
+        auth2.RegisterFactory("SPAM", 1, factory);
+        auth2.Configure("SPAM");
+        ASSERT_TRUE(auth2.IsExtraProtocolStageNeededHere(context));
+        auth2.Reset();
+    }
+    factory = nullptr;
+    EXPECT_FALSE(factoryWeak.expired());
+    {
+        SmtpAuth::Client auth3;
+        auth3.RegisterFactory("SPAM", 1, factoryWeak.lock());
+        auth3.Configure("SPAM");
+        ASSERT_TRUE(auth3.IsExtraProtocolStageNeededHere(context));
+    }
+    EXPECT_TRUE(factoryWeak.expired());
+}
+
+TEST_F(ClientTests, StepTimeoutAbortsExchange) {
+    auth.SetTimeouts(timerWheel, 0.0, 5.0);
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    AdvanceTime(4.5);
+    EXPECT_FALSE(done);
+    SendContinueRequest();
+    AdvanceTime(4.5);
+    EXPECT_FALSE(done);
+    AdvanceTime(1.0);
+    EXPECT_TRUE(done);
+    EXPECT_FALSE(success);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH FOO " + Base64::Encode("PogChamp") + "\r\n",
+            Base64::Encode("LetMeIn") + "\r\n",
+            "*\r\n",
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::StepTimeout, auth.GetFailureReason());
+    EXPECT_FALSE(auth.IsExtraProtocolStageNeededHere(context));
+}
+
+TEST_F(ClientTests, ExchangeTimeoutAbortsExchange) {
+    auth.SetTimeouts(timerWheel, 8.0, 5.0);
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    AdvanceTime(4.0);
+    SendContinueRequest();
+    AdvanceTime(3.5);
+    EXPECT_FALSE(done);
+    AdvanceTime(0.5);
+    EXPECT_TRUE(done);
+    EXPECT_FALSE(success);
+    EXPECT_EQ("*\r\n", messagesSent.back());
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::ExchangeTimeout, auth.GetFailureReason());
+}
+
+TEST_F(ClientTests, NoTimeoutIfDeadlinePassesAsContinueRequestHandled) {
+    auth.SetTimeouts(timerWheel, 0.0, 5.0);
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    (void)timerWheel->Schedule(5.0, [this]{ SendContinueRequest(); });
+    SendGoAhead();
+    AdvanceTime(5.0);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH FOO " + Base64::Encode("PogChamp") + "\r\n",
+            Base64::Encode("LetMeIn") + "\r\n",
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::None, auth.GetFailureReason());
+}
+
+TEST_F(ClientTests, NoTimeoutIfDeadlinePassesAsRejectionHandled) {
+    auth.SetTimeouts(timerWheel, 0.0, 5.0);
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    (void)timerWheel->Schedule(5.0, [this]{ SendRejection(535, "Go away, you smell"); });
+    SendGoAhead();
+    AdvanceTime(5.0);
+    EXPECT_FALSE(lastHandleServerMessageResult);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(1, messagesSent.size());
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::Rejected, auth.GetFailureReason());
+}
+
+TEST_F(ClientTests, NoTimeoutAfterSuccessfulAuthentication) {
+    auth.SetTimeouts(timerWheel, 8.0, 5.0);
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    Smtp::Client::ParsedMessage parsedMessage;
+    parsedMessage.code = 235;
+    parsedMessage.last = true;
+    parsedMessage.text = "authenticated";
+    ASSERT_TRUE(auth.HandleServerMessage(context, parsedMessage));
+    ASSERT_TRUE(done);
+    ASSERT_TRUE(success);
+    done = false;
+    AdvanceTime(10.0);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(1, messagesSent.size());
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::None, auth.GetFailureReason());
+}
+
+TEST_F(ClientTests, NoTimeoutAfterReset) {
+    auth.SetTimeouts(timerWheel, 8.0, 5.0);
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    auth.Reset();
+    AdvanceTime(10.0);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(1, messagesSent.size());
+}
+
+TEST_F(ClientTests, FailureReasonForRejection) {
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::None, auth.GetFailureReason());
+    Smtp::Client::ParsedMessage parsedMessage;
+    parsedMessage.code = 535;
+    parsedMessage.last = true;
+    parsedMessage.text = "Go away, you smell";
+    ASSERT_FALSE(auth.HandleServerMessage(context, parsedMessage));
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::Rejected, auth.GetFailureReason());
+}
+
+TEST_F(ClientTests, TransientRejectionRetriedWithinSession) {
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    configuration.baseDelay = 1.0;
+    configuration.maxDelay = 1.0;
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(configuration, timeKeeper),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    EXPECT_TRUE(lastHandleServerMessageResult);
+    EXPECT_FALSE(done);
+    const auto classification = auth.GetLastReplyClassification();
+    EXPECT_EQ(454, classification.code);
+    EXPECT_EQ(SmtpAuth::ReplyClassification::Severity::Transient, classification.severity);
+    EXPECT_EQ(4, classification.enhancedStatusClass);
+    EXPECT_EQ(1, messagesSent.size());
+    AdvanceTime(1.5);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH FOO " + Base64::Encode("PogChamp") + "\r\n",
+            "AUTH FOO " + Base64::Encode("PogChamp") + "\r\n",
+        }),
+        messagesSent
+    );
+    EXPECT_TRUE(mech1->wasReset);
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::None, auth.GetFailureReason());
+    Smtp::Client::ParsedMessage parsedMessage;
+    parsedMessage.code = 235;
+    parsedMessage.last = true;
+    parsedMessage.text = "authenticated";
+    ASSERT_TRUE(auth.HandleServerMessage(context, parsedMessage));
+    EXPECT_TRUE(done);
+    EXPECT_TRUE(success);
+}
+
+TEST_F(ClientTests, ExchangeTimeoutWhileWaitingToRetry) {
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    configuration.baseDelay = 3600.0;
+    configuration.maxDelay = 3600.0;
+    auth.SetTimeouts(timerWheel, 2.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(configuration, timeKeeper),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    ASSERT_TRUE(lastHandleServerMessageResult);
+    AdvanceTime(2.5);
+    if (
+        (messagesSent.size() > 1)
+        && (messagesSent[1].substr(0, 5) == "AUTH ")
+    ) { // jitter picked a very short delay
+        return;
+    }
+    EXPECT_TRUE(done);
+    EXPECT_FALSE(success);
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::ExchangeTimeout, auth.GetFailureReason());
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH FOO " + Base64::Encode("PogChamp") + "\r\n",
+        }),
+        messagesSent
+    );
+    AdvanceTime(3600.0);
+    EXPECT_EQ(1, messagesSent.size());
+}
+
+TEST_F(ClientTests, PermanentRejectionNotRetried) {
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(
+            SmtpAuth::RetryPolicy::Configuration(),
+            timeKeeper
+        ),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(535, "5.7.8 Authentication credentials invalid");
+    EXPECT_FALSE(lastHandleServerMessageResult);
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Permanent,
+        auth.GetLastReplyClassification().severity
+    );
+    EXPECT_FALSE(auth.GetRetryDecision().retry);
+    AdvanceTime(60.0);
+    EXPECT_EQ(1, messagesSent.size());
+}
+
+TEST_F(ClientTests, TransientRejectionNotRetriedOnceRetriesUsedUp) {
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    configuration.maxRetries = 1;
+    configuration.baseDelay = 1.0;
+    configuration.maxDelay = 1.0;
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(configuration, timeKeeper),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    ASSERT_TRUE(lastHandleServerMessageResult);
+    AdvanceTime(1.5);
+    ASSERT_EQ(2, messagesSent.size());
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    EXPECT_FALSE(lastHandleServerMessageResult);
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::Rejected, auth.GetFailureReason());
+    AdvanceTime(10.0);
+    EXPECT_EQ(2, messagesSent.size());
+}
+
+TEST_F(ClientTests, OpenCircuitBreakerFailsFast) {
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    configuration.failureThreshold = 1;
+    configuration.openDuration = 60.0;
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(configuration, timeKeeper),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    ASSERT_FALSE(lastHandleServerMessageResult);
+    ASSERT_EQ(1, messagesSent.size());
+    auth.Reset();
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_TRUE(done);
+    EXPECT_FALSE(success);
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::CircuitOpen, auth.GetFailureReason());
+    EXPECT_FALSE(auth.GetRetryDecision().retry);
+    EXPECT_EQ(1, messagesSent.size());
+    done = false;
+    AdvanceTime(60.0);
+    auth.Reset();
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_FALSE(done);
+    EXPECT_EQ(2, messagesSent.size());
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::None, auth.GetFailureReason());
+}
+
+TEST_F(ClientTests, RetryNotSentOnceCircuitBreakerOpens) {
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    configuration.failureThreshold = 2;
+    configuration.baseDelay = 1.0;
+    configuration.maxDelay = 1.0;
+    const auto retryPolicy = std::make_shared< SmtpAuth::RetryPolicy >(configuration, timeKeeper);
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(retryPolicy, "mail.example.com");
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    ASSERT_TRUE(lastHandleServerMessageResult);
+    SmtpAuth::Client auth2;
+    auth2.Register("FOO", 1, mech1);
+    auth2.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth2.SetRetryPolicy(retryPolicy, "mail.example.com");
+    auth2.Configure("FOO");
+    ASSERT_TRUE(auth2.IsExtraProtocolStageNeededHere(context));
+    auth2.GoAhead(
+        [](const std::string& data){},
+        [](bool success){}
+    );
+    Smtp::Client::ParsedMessage parsedMessage;
+    parsedMessage.code = 454;
+    parsedMessage.last = true;
+    parsedMessage.text = "4.7.0 Temporary authentication failure";
+    ASSERT_FALSE(auth2.HandleServerMessage(context, parsedMessage));
+    AdvanceTime(1.5);
+    EXPECT_TRUE(done);
+    EXPECT_FALSE(success);
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::CircuitOpen, auth.GetFailureReason());
+    EXPECT_EQ(1, messagesSent.size());
+}
+
+TEST_F(ClientTests, PasswordTransitionNotRetriedWithinSession) {
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(
+            SmtpAuth::RetryPolicy::Configuration(),
+            timeKeeper
+        ),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(432, "4.7.12 A password transition is needed");
+    EXPECT_FALSE(lastHandleServerMessageResult);
+    const auto classification = auth.GetLastReplyClassification();
+    EXPECT_EQ(SmtpAuth::ReplyClassification::Severity::Transient, classification.severity);
+    EXPECT_FALSE(classification.retryable);
+    EXPECT_FALSE(auth.GetRetryDecision().retry);
+    AdvanceTime(60.0);
+    EXPECT_EQ(1, messagesSent.size());
+}
+
+TEST_F(ClientTests, ServiceShuttingDownNotRetriedWithinSession) {
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    configuration.baseDelay = 1.0;
+    configuration.maxDelay = 1.0;
+    auth.SetTimeouts(timerWheel, 0.0, 0.0);
+    auth.SetRetryPolicy(
+        std::make_shared< SmtpAuth::RetryPolicy >(configuration, timeKeeper),
+        "mail.example.com"
+    );
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(421, "4.3.2 Service shutting down");
+    EXPECT_FALSE(lastHandleServerMessageResult);
+    const auto classification = auth.GetLastReplyClassification();
+    EXPECT_EQ(SmtpAuth::ReplyClassification::Severity::Transient, classification.severity);
+    EXPECT_FALSE(classification.retryable);
+    EXPECT_EQ(SmtpAuth::Client::FailureReason::Rejected, auth.GetFailureReason());
+    const auto decision = auth.GetRetryDecision();
+    EXPECT_TRUE(decision.retry);
+    EXPECT_LE(decision.delay, 1.0);
+    AdvanceTime(60.0);
+    EXPECT_EQ(1, messagesSent.size());
+}
+
+TEST_F(ClientTests, TransientRejectionWithoutRetryPolicy) {
+    auth.Configure("FOO");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    SendRejection(454, "4.7.0 Temporary authentication failure");
+    EXPECT_FALSE(lastHandleServerMessageResult);
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Transient,
+        auth.GetLastReplyClassification().severity
+    );
+}
+
+TEST_F(ClientTests, EmptyInitialResponseNotSentByDefault) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("EXTERNAL", 3, mech);
+    auth.Configure("EXTERNAL");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH EXTERNAL\r\n"
+        }),
+        messagesSent
+    );
+}
+
+TEST_F(ClientTests, ResponseToEmptyChallengeSentAsInitialResponseWhenMinimizingRoundTrips) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("EXTERNAL", 3, mech);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("EXTERNAL");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH EXTERNAL " + Base64::Encode("LetMeIn") + "\r\n"
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(
+        std::vector< std::string >({
+            ""
+        }),
+        mech->challengesReceived
+    );
+}
+
+TEST_F(ClientTests, EmptyResponseToEmptyChallengeSentAsEqualsSign) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    mech->proceedResponse = "";
+    auth.Register("EXTERNAL", 3, mech);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("EXTERNAL");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH EXTERNAL =\r\n"
+        }),
+        messagesSent
+    );
+}
+
+TEST_F(ClientTests, EmptyChallengeSentAnywayGetsSameResponse) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("EXTERNAL", 3, mech);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("EXTERNAL");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    Smtp::Client::ParsedMessage parsedMessage;
+    parsedMessage.code = 334;
+    parsedMessage.last = true;
+    parsedMessage.text = "";
+    ASSERT_TRUE(auth.HandleServerMessage(context, parsedMessage));
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH EXTERNAL " + Base64::Encode("LetMeIn") + "\r\n",
+            Base64::Encode("LetMeIn") + "\r\n",
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(1, mech->challengesReceived.size());
+}
+
+TEST_F(ClientTests, NoInitialResponseForServerFirstMechanismWhenMinimizingRoundTrips) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("CRAM-MD5", 3, mech);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("CRAM-MD5");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH CRAM-MD5\r\n"
+        }),
+        messagesSent
+    );
+    EXPECT_TRUE(mech->challengesReceived.empty());
+}
+
+TEST_F(ClientTests, PredictedFirstChallengeAnsweredInInitialResponse) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("LOGIN", 3, mech);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("LOGIN");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH LOGIN " + Base64::Encode("LetMeIn") + "\r\n"
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "Username:"
+        }),
+        mech->challengesReceived
+    );
+    SendContinueRequest();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "Username:",
+            "Password:",
+        }),
+        mech->challengesReceived
+    );
+}
+
+TEST_F(ClientTests, PredictedChallengeSentAnywayGetsSameResponse) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("LOGIN", 3, mech);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("LOGIN");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    Smtp::Client::ParsedMessage parsedMessage;
+    parsedMessage.code = 334;
+    parsedMessage.last = true;
+    parsedMessage.text = Base64::Encode("Username:");
+    ASSERT_TRUE(auth.HandleServerMessage(context, parsedMessage));
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH LOGIN " + Base64::Encode("LetMeIn") + "\r\n",
+            Base64::Encode("LetMeIn") + "\r\n",
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "Username:"
+        }),
+        mech->challengesReceived
+    );
+}
+
+TEST_F(ClientTests, CustomChallengePrediction) {
+    const auto mech = std::make_shared< MockSaslMechanism >("");
+    auth.Register("SPAM", 3, mech);
+    SmtpAuth::Client::ChallengePrediction prediction;
+    prediction.initialResponseAllowed = true;
+    prediction.firstChallengeKnown = true;
+    prediction.firstChallenge = "Kappa";
+    auth.SetChallengePrediction("SPAM", prediction);
+    auth.SetMinimizeRoundTrips(true);
+    auth.Configure("SPAM");
+    context.protocolStage = Smtp::Client::ProtocolStage::ReadyToSend;
+    ASSERT_TRUE(auth.IsExtraProtocolStageNeededHere(context));
+    SendGoAhead();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "AUTH SPAM " + Base64::Encode("LetMeIn") + "\r\n"
+        }),
+        messagesSent
+    );
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "Kappa"
+        }),
+        mech->challengesReceived
+    );
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/**
+ * @file MockTimeKeeper.hpp
+ *
+ * This module declares the MockTimeKeeper structure, which is shared
+ * by the unit tests of the timing components of this library.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <SmtpAuth/TimeKeeper.hpp>
+
+/**
+ * This is a fake time-keeper which is used to test the timing
+ * components of this library.
+ */
+struct MockTimeKeeper
+    : public SmtpAuth::TimeKeeper
+{
+    // Properties
+
+    double currentTime = 0.0;
+
+    // SmtpAuth::TimeKeeper
+
+    virtual double GetCurrentTime() override {
+        return currentTime;
+    }
+};
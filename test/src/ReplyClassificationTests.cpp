@@ -0,0 +1,118 @@
+/**
+ * @file ReplyClassificationTests.cpp
+ *
+ * This module contains the unit tests of the SmtpAuth::ClassifyReply
+ * function.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <SmtpAuth/ReplyClassification.hpp>
+#include <string>
+
+namespace {
+
+    /**
+     * Classify a reply with the given code and text.
+     *
+     * @param[in] code
+     *     This is the reply code of the reply.
+     *
+     * @param[in] text
+     *     This is the text of the reply.
+     *
+     * @return
+     *     The classification of the reply is returned.
+     */
+    SmtpAuth::ReplyClassification Classify(
+        int code,
+        const std::string& text
+    ) {
+        Smtp::Client::ParsedMessage message;
+        message.code = code;
+        message.last = true;
+        message.text = text;
+        return SmtpAuth::ClassifyReply(message);
+    }
+
+}
+
+TEST(ReplyClassificationTests, SeverityFromReplyCode) {
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Success,
+        Classify(235, "2.7.0 Authentication successful").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Intermediate,
+        Classify(334, "").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Transient,
+        Classify(454, "4.7.0 Temporary authentication failure").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Transient,
+        Classify(432, "4.7.12 A password transition is needed").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Permanent,
+        Classify(535, "5.7.8 Authentication credentials invalid").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Permanent,
+        Classify(534, "5.7.9 Authentication mechanism is too weak").severity
+    );
+}
+
+TEST(ReplyClassificationTests, EnhancedStatusCodeParsed) {
+    const auto classification = Classify(432, "4.7.12 A password transition is needed");
+    EXPECT_EQ(432, classification.code);
+    EXPECT_TRUE(classification.hasEnhancedStatusCode);
+    EXPECT_EQ(4, classification.enhancedStatusClass);
+    EXPECT_EQ(7, classification.enhancedStatusSubject);
+    EXPECT_EQ(12, classification.enhancedStatusDetail);
+}
+
+TEST(ReplyClassificationTests, NoEnhancedStatusCode) {
+    EXPECT_FALSE(Classify(535, "Go away, you smell").hasEnhancedStatusCode);
+    EXPECT_FALSE(Classify(535, "").hasEnhancedStatusCode);
+    EXPECT_FALSE(Classify(535, "5.7").hasEnhancedStatusCode);
+    EXPECT_FALSE(Classify(535, "5.7.8x nope").hasEnhancedStatusCode);
+    EXPECT_FALSE(Classify(535, "5.7.1234 nope").hasEnhancedStatusCode);
+    EXPECT_FALSE(Classify(535, "3.7.8 nope").hasEnhancedStatusCode);
+}
+
+TEST(ReplyClassificationTests, EnhancedStatusCodeUsedForUnrecognizedReplyCode) {
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Transient,
+        Classify(0, "4.7.0 Try again later").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Permanent,
+        Classify(0, "5.7.0 Nope").severity
+    );
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Permanent,
+        Classify(0, "FeelsBadMan").severity
+    );
+}
+
+TEST(ReplyClassificationTests, ReplyCodeTakesPrecedenceOverEnhancedStatusCode) {
+    EXPECT_EQ(
+        SmtpAuth::ReplyClassification::Severity::Permanent,
+        Classify(535, "4.7.0 Confused server").severity
+    );
+}
+
+TEST(ReplyClassificationTests, Retryable) {
+    EXPECT_TRUE(Classify(454, "4.7.0 Temporary authentication failure").retryable);
+    EXPECT_TRUE(Classify(454, "Temporary authentication failure").retryable);
+    EXPECT_FALSE(Classify(421, "4.3.2 Service shutting down").retryable);
+    EXPECT_FALSE(Classify(432, "4.7.12 A password transition is needed").retryable);
+    EXPECT_FALSE(Classify(432, "A password transition is needed").retryable);
+    EXPECT_FALSE(Classify(454, "4.7.12 A password transition is needed").retryable);
+    EXPECT_FALSE(Classify(454, "5.7.0 Confused server").retryable);
+    EXPECT_FALSE(Classify(535, "5.7.8 Authentication credentials invalid").retryable);
+    EXPECT_FALSE(Classify(235, "2.7.0 Authentication successful").retryable);
+}
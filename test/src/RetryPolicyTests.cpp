@@ -0,0 +1,117 @@
+/**
+ * @file RetryPolicyTests.cpp
+ *
+ * This module contains the unit tests of the SmtpAuth::RetryPolicy class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <SmtpAuth/RetryPolicy.hpp>
+#include "MockTimeKeeper.hpp"
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct RetryPolicyTests
+    : public ::testing::Test
+{
+    // Properties
+
+    std::shared_ptr< MockTimeKeeper > timeKeeper = std::make_shared< MockTimeKeeper >();
+    SmtpAuth::RetryPolicy::Configuration configuration;
+    std::unique_ptr< SmtpAuth::RetryPolicy > policy;
+
+    // ::testing::Test
+
+    virtual void SetUp() override {
+        configuration.maxRetries = 3;
+        configuration.baseDelay = 1.0;
+        configuration.maxDelay = 3.0;
+        configuration.failureThreshold = 4;
+        configuration.openDuration = 60.0;
+        policy.reset(new SmtpAuth::RetryPolicy(configuration, timeKeeper));
+    }
+
+    virtual void TearDown() override {
+    }
+};
+
+TEST_F(RetryPolicyTests, TransientFailureRetriedWithJitteredBackoff) {
+    for (size_t retriesSoFar = 0; retriesSoFar < 3; ++retriesSoFar) {
+        const auto decision = policy->ReportFailure("mail.example.com", true, retriesSoFar);
+        EXPECT_TRUE(decision.retry);
+        EXPECT_GE(decision.delay, 0.0);
+        EXPECT_LE(decision.delay, std::min(3.0, (double)(1 << retriesSoFar)));
+        policy->ReportSuccess("mail.example.com");
+    }
+}
+
+TEST_F(RetryPolicyTests, RetriesUsedUp) {
+    EXPECT_FALSE(policy->ReportFailure("mail.example.com", true, 3).retry);
+}
+
+TEST_F(RetryPolicyTests, PermanentFailureNotRetried) {
+    EXPECT_FALSE(policy->ReportFailure("mail.example.com", false, 0).retry);
+}
+
+TEST_F(RetryPolicyTests, BreakerOpensAfterRepeatedTransientFailures) {
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_TRUE(policy->ReportFailure("mail.example.com", true, 0).retry);
+        EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+    }
+    EXPECT_FALSE(policy->ReportFailure("mail.example.com", true, 0).retry);
+    EXPECT_FALSE(policy->IsAttemptAllowed("mail.example.com"));
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.org"));
+}
+
+TEST_F(RetryPolicyTests, BreakerAllowsOneTrialAfterCoolDown) {
+    for (size_t i = 0; i < 4; ++i) {
+        (void)policy->ReportFailure("mail.example.com", true, 0);
+    }
+    timeKeeper->currentTime = 59.0;
+    EXPECT_FALSE(policy->IsAttemptAllowed("mail.example.com"));
+    timeKeeper->currentTime = 60.0;
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+    EXPECT_FALSE(policy->IsAttemptAllowed("mail.example.com"));
+    policy->ReportSuccess("mail.example.com");
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+}
+
+TEST_F(RetryPolicyTests, FailedTrialReopensBreaker) {
+    for (size_t i = 0; i < 4; ++i) {
+        (void)policy->ReportFailure("mail.example.com", true, 0);
+    }
+    timeKeeper->currentTime = 60.0;
+    ASSERT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+    EXPECT_FALSE(policy->ReportFailure("mail.example.com", true, 0).retry);
+    timeKeeper->currentTime = 119.0;
+    EXPECT_FALSE(policy->IsAttemptAllowed("mail.example.com"));
+    timeKeeper->currentTime = 120.0;
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+}
+
+TEST_F(RetryPolicyTests, PermanentFailureClosesBreaker) {
+    for (size_t i = 0; i < 4; ++i) {
+        (void)policy->ReportFailure("mail.example.com", true, 0);
+    }
+    timeKeeper->currentTime = 60.0;
+    ASSERT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+    (void)policy->ReportFailure("mail.example.com", false, 0);
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+}
+
+TEST_F(RetryPolicyTests, FailureAfterCoolDownCountsAsFailedTrial) {
+    for (size_t i = 0; i < 4; ++i) {
+        (void)policy->ReportFailure("mail.example.com", true, 0);
+    }
+    timeKeeper->currentTime = 60.0;
+    EXPECT_FALSE(policy->ReportFailure("mail.example.com", true, 0).retry);
+    timeKeeper->currentTime = 119.0;
+    EXPECT_FALSE(policy->IsAttemptAllowed("mail.example.com"));
+    timeKeeper->currentTime = 120.0;
+    EXPECT_TRUE(policy->IsAttemptAllowed("mail.example.com"));
+}
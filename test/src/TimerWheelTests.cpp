@@ -0,0 +1,120 @@
+/**
+ * @file TimerWheelTests.cpp
+ *
+ * This module contains the unit tests of the SmtpAuth::TimerWheel class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <SmtpAuth/TimerWheel.hpp>
+#include <vector>
+#include "MockTimeKeeper.hpp"
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct TimerWheelTests
+    : public ::testing::Test
+{
+    // Properties
+
+    std::shared_ptr< MockTimeKeeper > timeKeeper = std::make_shared< MockTimeKeeper >();
+    std::unique_ptr< SmtpAuth::TimerWheel > wheel;
+    std::vector< int > callbacksCalled;
+
+    // Methods
+
+    std::function< void() > MakeCallback(int id) {
+        return [this, id]{ callbacksCalled.push_back(id); };
+    }
+
+    void AdvanceTo(double time) {
+        timeKeeper->currentTime = time;
+        wheel->Advance();
+    }
+
+    // ::testing::Test
+
+    virtual void SetUp() override {
+        timeKeeper->currentTime = 100.0;
+        wheel.reset(new SmtpAuth::TimerWheel(timeKeeper, 0.5, 8));
+    }
+
+    virtual void TearDown() override {
+    }
+};
+
+TEST_F(TimerWheelTests, CallbackCalledOnlyAfterDeadline) {
+    (void)wheel->Schedule(2.0, MakeCallback(1));
+    AdvanceTo(101.9);
+    EXPECT_TRUE(callbacksCalled.empty());
+    AdvanceTo(102.0);
+    EXPECT_EQ(std::vector< int >({1}), callbacksCalled);
+    AdvanceTo(110.0);
+    EXPECT_EQ(std::vector< int >({1}), callbacksCalled);
+}
+
+TEST_F(TimerWheelTests, CancelledCallbackNotCalled) {
+    const auto token = wheel->Schedule(1.0, MakeCallback(1));
+    (void)wheel->Schedule(1.0, MakeCallback(2));
+    wheel->Cancel(token);
+    AdvanceTo(102.0);
+    EXPECT_EQ(std::vector< int >({2}), callbacksCalled);
+}
+
+TEST_F(TimerWheelTests, DeadlineBeyondOneRotation) {
+    (void)wheel->Schedule(10.0, MakeCallback(1));
+    (void)wheel->Schedule(1.0, MakeCallback(2));
+    for (double time = 100.25; time < 109.9; time += 0.25) {
+        AdvanceTo(time);
+    }
+    EXPECT_EQ(std::vector< int >({2}), callbacksCalled);
+    AdvanceTo(110.0);
+    EXPECT_EQ(std::vector< int >({2, 1}), callbacksCalled);
+}
+
+TEST_F(TimerWheelTests, LargeJumpCallsAllExpiredCallbacks) {
+    (void)wheel->Schedule(1.0, MakeCallback(1));
+    (void)wheel->Schedule(3.0, MakeCallback(2));
+    (void)wheel->Schedule(30.0, MakeCallback(3));
+    AdvanceTo(120.0);
+    EXPECT_EQ(2, callbacksCalled.size());
+    AdvanceTo(130.0);
+    EXPECT_EQ(3, callbacksCalled.size());
+}
+
+TEST_F(TimerWheelTests, CallbackMayScheduleAnotherCallback) {
+    (void)wheel->Schedule(
+        1.0,
+        [this]{
+            callbacksCalled.push_back(1);
+            (void)wheel->Schedule(1.0, MakeCallback(2));
+        }
+    );
+    AdvanceTo(101.0);
+    EXPECT_EQ(std::vector< int >({1}), callbacksCalled);
+    AdvanceTo(102.0);
+    EXPECT_EQ(std::vector< int >({1, 2}), callbacksCalled);
+}
+
+TEST_F(TimerWheelTests, WheelDestroyedFromWorkerThreadCallback) {
+    auto workerWheel = std::make_shared< SmtpAuth::TimerWheel >(nullptr, 0.01, 8);
+    std::promise< void > callbackDone;
+    (void)workerWheel->Schedule(
+        0.0,
+        [&workerWheel, &callbackDone]{
+            workerWheel = nullptr;
+            callbackDone.set_value();
+        }
+    );
+    workerWheel->Start();
+    EXPECT_EQ(
+        std::future_status::ready,
+        callbackDone.get_future().wait_for(std::chrono::seconds(5))
+    );
+}